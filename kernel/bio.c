@@ -102,6 +102,16 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block, which the caller
+// is about to overwrite entirely. Unlike bread(), does not read
+// the block from disk if it is not cached; b->valid is left 0
+// in that case, and the caller sets it once b->data is filled.
+struct buf*
+boverwrite(uint dev, uint blockno)
+{
+  return bget(dev, blockno);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -21,14 +21,16 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
+#include "waitq.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
 
 //
-// send one character to the uart.
-// called by printf(), and to echo input characters,
-// but not from write().
+// send one character to the uart, synchronously.
+// called by printf() once the kernel has panicked,
+// and to echo input characters, but not from write().
 //
 void
 consputc(int c)
@@ -50,6 +52,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct waitq wq;  // polls waiting for a line
 } cons;
 
 //
@@ -58,13 +62,16 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[128];
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartwrite(buf, m);
   }
 
   return i;
@@ -170,6 +177,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        waitqwake(&cons.wq);
       }
     }
     break;
@@ -178,15 +186,35 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+//
+// poll() asks whether a read would wait.
+// writes may wait for the uart, but not for long.
+//
+int
+consolepoll(struct pollentry *e)
+{
+  int r = POLLOUT;
+
+  if(e)
+    waitqadd(&cons.wq, e);
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
   initlock(&cons.lock, "cons");
+  waitqinit(&cons.wq);
 
   uartinit();
 
-  // connect read and write system calls
-  // to consoleread and consolewrite.
+  // connect read, write and poll system calls
+  // to consoleread, consolewrite and consolepoll.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -1,17 +1,22 @@
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
+struct pollentry;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct waitq;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     boverwrite(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -31,12 +36,26 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int n, uint);
+int             filepoll(struct file*, struct pollentry*);
+int             filesplice(struct file*, struct file*, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepwrite(struct file*, uint64, int n, uint);
+struct fdtable* fdtalloc(struct inode*);
+struct fdtable* fdtcopy(struct fdtable*);
+struct fdtable* fdtdup(struct fdtable*);
+struct file*    fdtget(struct fdtable*, int);
+void            fdtput(struct fdtable*);
 
 // fs.c
 void            fsinit(int);
+void            dcache_unlink(struct inode*, char*);
+int             dirinit(struct inode*, int);
 int             dirlink(struct inode*, char*, uint);
+int             isdirempty(struct inode*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -44,15 +63,19 @@ void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            ilockshared(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             ffz(uint64);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -69,17 +92,35 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipepoll(struct pipe*, struct pollentry*);
+int             pipeput(struct pipe*, char*, int);
+int             pipewait(struct pipe*, int);
+
+// klog.c
+void            kloginit(void);
+void            klogwrite(char*, int);
+int             klogread(uint64, int);
+
+// poll.c
+void            pollinit(void);
+void            polltick(uint);
+int             poll(uint64, int, int);
+void            waitqinit(struct waitq*);
+void            waitqadd(struct waitq*, struct pollentry*);
+void            waitqwake(struct waitq*);
 
 // printf.c
 int            printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
+void            klog(char*, ...) __attribute__ ((format (printf, 1, 2)));
 void            panic(char*) __attribute__((noreturn));
-void            printfinit(void);
 
 // proc.c
 int             cpuid(void);
@@ -124,6 +165,8 @@ void            pop_off(void);
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -144,6 +187,9 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+void            fdrelease(void);
+
 
 // custom MLFQ and FCFS system calls 
 uint64          sys_getlev(void); 
@@ -166,7 +212,9 @@ void            usertrapret(void);
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartwrite(char*, int);
+void            uartputs(char*, int);
+void            uartflush(void);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -198,6 +246,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_writev(struct buf **, int, uint);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -6,8 +6,14 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#define MAXSEG 8  // loadable segments an executable may have
+
+static int elfread(struct inode *, uint64 *, struct elfseg *);
+static uint64 loadseg(pagetable_t, uint64, struct inode *, struct elfseg *);
 extern struct proc proc[NPROC];
 
 int flags2perm(int flags)
@@ -24,11 +30,10 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
-  struct elfhdr elf;
+  int i, nseg;
+  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase, entry;
+  struct elfseg seg[MAXSEG];
   struct inode *ip;
-  struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -38,38 +43,24 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
-  // Check ELF header
-  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-
-  if(elf.magic != ELF_MAGIC)
+  // Check ELF header and program headers.
+  if((nseg = elfread(ip, &entry, seg)) < 0)
     goto bad;
 
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
   // Load program into memory.
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
+  for(i = 0; i < nseg; i++){
     uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if((sz1 = loadseg(pagetable, sz, ip, &seg[i])) == 0)
       goto bad;
     sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
   }
-  iunlockput(ip);
+  iunlockshared(ip);
+  iput(ip);
   end_op();
   ip = 0;
 
@@ -135,9 +126,10 @@ exec(char *path, char **argv)
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
-  p->trapframe->epc = elf.entry;  // initial program counter = main
+  p->trapframe->epc = entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  p->ring = 0;
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -145,33 +137,113 @@ exec(char *path, char **argv)
   if(pagetable)
     proc_freepagetable(pagetable, sz);
   if(ip){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     end_op();
   }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
+// Read ip's ELF header and the program headers of its
+// loadable segments into *entry and seg, which has room for
+// MAXSEG. Caller holds ip's lock, shared, so ip cannot change,
+// but other exec()s may be reading it too; ip->maplock guards
+// the copy cached in ip, which saves reading and checking the
+// headers again the next time ip is run.
+// Returns the number of segments, or -1.
 static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+elfread(struct inode *ip, uint64 *entry, struct elfseg *seg)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+  struct elfhdr elf;
+  struct proghdr ph;
+  int i, n;
+  uint off;
+
+  acquiresleep(&ip->maplock);
+  if((n = ip->nelfseg) > 0){
+    *entry = ip->elfentry;
+    memmove(seg, ip->elfseg, n * sizeof(*seg));
+  }
+  releasesleep(&ip->maplock);
+  if(n > 0)
+    return n;
+
+  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
+    return -1;
+  if(elf.magic != ELF_MAGIC)
+    return -1;
+  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
+    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+      return -1;
+    if(ph.type != ELF_PROG_LOAD)
+      continue;
+    if(ph.memsz < ph.filesz)
+      return -1;
+    if(ph.vaddr + ph.memsz < ph.vaddr)
+      return -1;
+    if(ph.vaddr % PGSIZE != 0)
+      return -1;
+    if(ph.off > ip->size || ph.filesz > ip->size - ph.off)
+      return -1;
+    if(n == MAXSEG)
       return -1;
+    seg[n].vaddr = ph.vaddr;
+    seg[n].memsz = ph.memsz;
+    seg[n].off = ph.off;
+    seg[n].filesz = ph.filesz;
+    seg[n].flags = ph.flags;
+    n++;
+  }
+  *entry = elf.entry;
+
+  if(n > 0 && n <= NELFSEG){
+    acquiresleep(&ip->maplock);
+    ip->elfentry = elf.entry;
+    memmove(ip->elfseg, seg, n * sizeof(*seg));
+    ip->nelfseg = n;
+    releasesleep(&ip->maplock);
+  }
+  return n;
+}
+
+// Map fresh pages into pagetable from sz up to the end of
+// segment s, reading the segment's contents from ip straight
+// into each page a page at a time and zeroing the rest.
+// s->vaddr must be page-aligned and at least sz.
+// Returns the new size, or 0 on failure.
+static uint64
+loadseg(pagetable_t pagetable, uint64 sz, struct inode *ip, struct elfseg *s)
+{
+  char *mem;
+  uint64 a, oldsz, end;
+  uint n;
+
+  if(s->vaddr < sz)
+    return 0;
+  oldsz = PGROUNDUP(sz);
+  end = s->vaddr + s->memsz;
+  for(a = oldsz; a < end; a += PGSIZE){
+    if((mem = kalloc()) == 0)
+      goto bad;
+    n = 0;
+    if(a >= s->vaddr && a - s->vaddr < s->filesz){
+      n = s->filesz - (a - s->vaddr);
+      if(n > PGSIZE)
+        n = PGSIZE;
+      if(readi(ip, 0, (uint64)mem, s->off + (a - s->vaddr), n) != n){
+        kfree(mem);
+        goto bad;
+      }
+    }
+    memset(mem + n, 0, PGSIZE - n);
+    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|flags2perm(s->flags)) != 0){
+      kfree(mem);
+      goto bad;
+    }
   }
-  
+  return end;
+
+ bad:
+  uvmdealloc(pagetable, a, oldsz);
   return 0;
 }
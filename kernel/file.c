@@ -11,47 +11,120 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "uio.h"
+#include "poll.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// File structures are allocated a page at a time, up to
+// NFILE of them, and never freed. Free ones are kept on
+// free lists, one per CPU, which only that CPU uses, with
+// interrupts off, so allocating and freeing need no lock;
+// a CPU takes FBATCH at a time from, or gives them back
+// to, the shared list in ftable, under ftable.lock.
+// Reference counts are changed with atomic instructions.
+#define FBATCH 16
+
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct file *free;  // shared free list
+  int n;              // # of file structures allocated
 } ftable;
 
+struct {
+  struct file *free;
+  int nfree;
+} fcpu[NCPU];
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
 }
 
+// Move up to FBATCH free files from the shared list to the
+// calling CPU's, allocating another page of them if the
+// shared list is empty. Called with interrupts off.
+static void
+frefill(void)
+{
+  struct file *f, *end;
+  char *mem;
+  int i, id = cpuid();
+
+  acquire(&ftable.lock);
+  if(ftable.free == 0 && ftable.n + PGSIZE / sizeof(*f) <= NFILE &&
+     (mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    end = (struct file*)mem + PGSIZE / sizeof(*f);
+    for(f = (struct file*)mem; f < end; f++){
+      initsleeplock(&f->offlock, "file");
+      f->next = ftable.free;
+      ftable.free = f;
+      ftable.n++;
+    }
+  }
+  for(i = 0; i < FBATCH && (f = ftable.free) != 0; i++){
+    ftable.free = f->next;
+    f->next = fcpu[id].free;
+    fcpu[id].free = f;
+    fcpu[id].nfree++;
+  }
+  release(&ftable.lock);
+}
+
 // Allocate a file structure.
 struct file*
 filealloc(void)
 {
   struct file *f;
+  int id;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
+  push_off();
+  id = cpuid();
+  if(fcpu[id].free == 0)
+    frefill();
+  if((f = fcpu[id].free) != 0){
+    fcpu[id].free = f->next;
+    fcpu[id].nfree--;
+    f->ref = 1;
+  }
+  pop_off();
+  return f;
+}
+
+// Put f on the calling CPU's free list, giving FBATCH
+// back to the shared list if the CPU has too many.
+static void
+ffree(struct file *f)
+{
+  int i, id;
+
+  push_off();
+  id = cpuid();
+  f->next = fcpu[id].free;
+  fcpu[id].free = f;
+  if(++fcpu[id].nfree > 2*FBATCH){
+    acquire(&ftable.lock);
+    for(i = 0; i < FBATCH; i++){
+      f = fcpu[id].free;
+      fcpu[id].free = f->next;
+      f->next = ftable.free;
+      ftable.free = f;
     }
+    fcpu[id].nfree -= FBATCH;
+    release(&ftable.lock);
   }
-  release(&ftable.lock);
-  return 0;
+  pop_off();
 }
 
 // Increment ref count for file f.
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  if(__atomic_fetch_add(&f->ref, 1, __ATOMIC_RELAXED) < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
   return f;
 }
 
@@ -60,18 +133,15 @@ void
 fileclose(struct file *f)
 {
   struct file ff;
+  int ref;
 
-  acquire(&ftable.lock);
-  if(f->ref < 1)
+  if((ref = __atomic_sub_fetch(&f->ref, 1, __ATOMIC_ACQ_REL)) < 0)
     panic("fileclose");
-  if(--f->ref > 0){
-    release(&ftable.lock);
+  if(ref > 0)
     return;
-  }
   ff = *f;
-  f->ref = 0;
   f->type = FD_NONE;
-  release(&ftable.lock);
+  ffree(f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -82,6 +152,115 @@ fileclose(struct file *f)
   }
 }
 
+// Allocate a descriptor table with no open files and
+// current directory cwd, whose reference it takes over.
+struct fdtable*
+fdtalloc(struct inode *cwd)
+{
+  struct fdtable *t;
+
+  if((t = (struct fdtable*)kalloc()) == 0)
+    return 0;
+  memset(t, 0, sizeof(*t));
+  initlock(&t->lock, "fdtable");
+  t->ref = 1;
+  t->cwd = cwd;
+  return t;
+}
+
+// Copy descriptor table t for a new process, duplicating
+// each open file and the current directory.
+struct fdtable*
+fdtcopy(struct fdtable *t)
+{
+  struct fdtable *nt;
+  int fd;
+
+  if((nt = fdtalloc(0)) == 0)
+    return 0;
+  acquire(&t->lock);
+  nt->used = t->used;
+  for(fd = 0; fd < NOFILE; fd++)
+    if(t->ofile[fd])
+      nt->ofile[fd] = filedup(t->ofile[fd]);
+  nt->cwd = idup(t->cwd);
+  release(&t->lock);
+  return nt;
+}
+
+// Return a new reference to the file open as descriptor fd
+// in t, or 0.
+struct file*
+fdtget(struct fdtable *t, int fd)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&t->lock);
+  if((f = t->ofile[fd]) != 0)
+    filedup(f);
+  release(&t->lock);
+  return f;
+}
+
+// Share descriptor table t with another thread.
+struct fdtable*
+fdtdup(struct fdtable *t)
+{
+  if(__atomic_fetch_add(&t->ref, 1, __ATOMIC_RELAXED) < 1)
+    panic("fdtdup");
+  return t;
+}
+
+// Drop a reference to descriptor table t, closing its
+// files and freeing it when the last one goes.
+void
+fdtput(struct fdtable *t)
+{
+  int ref, fd;
+
+  if((ref = __atomic_sub_fetch(&t->ref, 1, __ATOMIC_ACQ_REL)) < 0)
+    panic("fdtput");
+  if(ref > 0)
+    return;
+  for(fd = 0; fd < NOFILE; fd++)
+    if(t->ofile[fd])
+      fileclose(t->ofile[fd]);
+  begin_op();
+  iput(t->cwd);
+  end_op();
+  kfree((char*)t);
+}
+
+// Return which of POLLIN, POLLOUT, POLLERR and POLLHUP hold
+// for f now. If e is not 0, also put it on the waitq of f's
+// pipe or device, so that poll() wakes up when they change.
+int
+filepoll(struct file *f, struct pollentry *e)
+{
+  int r;
+
+  if(f->type == FD_PIPE){
+    r = pipepoll(f->pipe, e);
+    if(!f->readable)
+      r &= ~(POLLIN | POLLHUP);
+    if(!f->writable)
+      r &= ~(POLLOUT | POLLERR);
+    return r;
+  }
+  // files never make reads or writes wait.
+  r = POLLIN | POLLOUT;
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].poll)
+    r = devsw[f->major].poll(e);
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -91,9 +270,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -112,16 +291,23 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, 1, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
+    if(f->nonblock && devsw[f->major].poll &&
+       (devsw[f->major].poll(0) & POLLIN) == 0)
+      return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
+    // readers of other files open on f->ip can go at the same
+    // time, but reads through f must see each other's f->off.
+    acquiresleep(&f->offlock);
+    ilockshared(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    iunlockshared(f->ip);
+    releasesleep(&f->offlock);
   } else {
     panic("fileread");
   }
@@ -129,50 +315,66 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// write up to MAXWRITEBLOCKS at a time to avoid exceeding
+// the maximum log transaction size, including
+// i-node, indirect block, allocation blocks,
+// and 2 blocks of slop for non-aligned writes.
+// each transaction reserves only what its part of the
+// write can touch, so small writes still share the log.
+// this really belongs lower down, since writei()
+// might be writing a device like the console.
+#define MAXWRITE (((MAXWRITEBLOCKS-1-1-2) / 2) * BSIZE)
+#define WRITEBLOCKS(n) (1 + 1 + 2 + 2 * (((n) + BSIZE - 1) / BSIZE))
+
+// Write n bytes from src to FD_INODE file f at *poff.
+// If user_src==1, then src is a user virtual address;
+// otherwise, src is a kernel address.
+static int
+filewritei(struct file *f, int user_src, uint64 src, int n, uint *poff)
+{
+  int r;
+
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > MAXWRITE)
+      n1 = MAXWRITE;
+    int nb = WRITEBLOCKS(n1);
+
+    begin_opn(nb);
+    ilock(f->ip);
+    if ((r = writei(f->ip, user_src, src + i, *poff, n1)) > 0)
+      *poff += r;
+    iunlock(f->ip);
+    end_opn(nb);
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return (i == n ? n : -1);
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, 1, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    ret = filewritei(f, 1, addr, n, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +382,181 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f into the niov buffers of iov in turn,
+// stopping at the first that is not filled. Reads an i-node
+// under one lock, so the buffers get consecutive data even
+// if others are reading through f too.
+int
+filereadv(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, tot = 0;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type != FD_INODE){
+    for(i = 0; i < niov; i++){
+      if((r = fileread(f, (uint64)iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return tot;
+  }
+
+  acquiresleep(&f->offlock);
+  ilockshared(f->ip);
+  for(i = 0; i < niov; i++){
+    if((r = readi(f->ip, 1, (uint64)iov[i].base, f->off, iov[i].len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    f->off += r;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  iunlockshared(f->ip);
+  releasesleep(&f->offlock);
+  return tot;
+}
+
+// Write the niov buffers of iov to file f in turn. If they
+// fit in one transaction, writes an i-node under one lock
+// and one begin_op(), so the write is atomic like write().
+int
+filewritev(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, n, nb, tot = 0;
+
+  if(f->writable == 0)
+    return -1;
+
+  n = 0;
+  for(i = 0; i < niov; i++)
+    n += iov[i].len;
+
+  if(f->type != FD_INODE || n > MAXWRITE){
+    for(i = 0; i < niov; i++){
+      if((r = filewrite(f, (uint64)iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return tot;
+  }
+
+  nb = WRITEBLOCKS(n);
+  begin_opn(nb);
+  ilock(f->ip);
+  for(i = 0; i < niov; i++){
+    if((r = writei(f->ip, 1, (uint64)iov[i].base, f->off, iov[i].len)) > 0)
+      f->off += r;
+    if(r != iov[i].len)
+      break;
+    tot += r;
+  }
+  iunlock(f->ip);
+  end_opn(nb);
+  return (i == niov ? tot : -1);
+}
+
+// Read from i-node file f at offset off, without using or
+// changing f->off, so that any number of processes can read
+// through f at once.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilockshared(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlockshared(f->ip);
+  return r;
+}
+
+// Write to i-node file f at offset off, without using or
+// changing f->off.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return filewritei(f, 1, addr, n, &off);
+}
+
+// Move n bytes from file f into pipe pi, straight from the
+// buffer cache. Waits for room in the pipe without holding
+// f's inode, so that the pipe's reader may use the file;
+// if nonblock, stops once the pipe is full instead.
+static int
+splicetopipe(struct file *f, struct pipe *pi, int n, int nonblock)
+{
+  int r, tot = 0;
+
+  acquiresleep(&f->offlock);
+  while(tot < n){
+    if(pipewait(pi, nonblock) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    ilockshared(f->ip);
+    if(f->off >= f->ip->size){
+      iunlockshared(f->ip);
+      break;
+    }
+    // update f->off before unlocking, since a write through f
+    // changes it holding only the inode lock.
+    if((r = readipipe(f->ip, pi, f->off, n - tot)) > 0)
+      f->off += r;
+    iunlockshared(f->ip);
+    if(r < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    tot += r;
+  }
+  releasesleep(&f->offlock);
+  return tot;
+}
+
+// Move up to n bytes from pipe pi into file f. Like read(),
+// returns once some data has arrived, or 0 at end of file;
+// if nonblock, returns -1 rather than wait for data.
+static int
+splicefrompipe(struct pipe *pi, struct file *f, int n, int nonblock)
+{
+  char *mem;
+  int r;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((r = piperead(pi, 0, (uint64)mem, n, nonblock)) > 0)
+    r = filewritei(f, 0, (uint64)mem, r, &f->off);
+  kfree(mem);
+  return r;
+}
+
+// Move up to n bytes from file in to file out inside the
+// kernel, without copying them through user space.
+// One of the files must be a pipe and the other an i-node.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return splicetopipe(in, out->pipe, n, out->nonblock);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return splicefrompipe(in->pipe, out, n, in->nonblock);
+  return -1;
+}
@@ -1,24 +1,40 @@
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
-  int ref; // reference count
+  int ref; // reference count, changed atomically
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: return -1 rather than wait
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct sleeplock offlock; // FD_INODE: serializes reads at off
   short major;       // FD_DEVICE
+  struct file *next; // free list, see file.c
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NINDCACHE 3   // indirect blocks an inode keeps copies of
+#define NELFSEG   4   // ELF program segments an inode keeps for exec
+
+// A loadable segment of an executable, as exec() caches it.
+struct elfseg {
+  uint64 vaddr;
+  uint64 memsz;
+  uint off;
+  uint filesz;
+  uint flags;
+};
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
+  struct sleeplock maplock; // protects block map and exec caches
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
@@ -26,13 +42,33 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint mapbn;         // block map cache: file blocks mapbn..
+  uint mapaddr;       // mapbn+maplen-1 are at disk blocks
+  uint maplen;        // mapaddr..mapaddr+maplen-1
+  uint lastblock;     // last block allocated, to allocate near
+  uint resstart;      // blocks resstart..resstart+reslen-1 are
+  uint reslen;        // reserved for this inode's next allocations
+  uint resgen;        // valid if resgen == resv.gen, see fs.c
+  char *ind;          // copies of indirect blocks, see fs.c
+  uint indaddr[NINDCACHE];
+  uint64 elfentry;    // exec cache, see exec.c: entry point and
+  int nelfseg;        // loadable segments, or 0 if not cached
+  struct elfseg elfseg[NELFSEG];
+
+  struct inode *hnext;  // hash chain, see fs.c
+  struct inode *prev;   // LRU list, if ref is 0
+  struct inode *next;
 };
 
+struct pollentry;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollentry*);  // POLLIN/POLLOUT now, see poll.c
 };
 
 extern struct devsw devsw[];
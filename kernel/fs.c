@@ -37,13 +37,22 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bresinit(void);
+static void imapinit(int dev);
+
 // Init fs
 void
 fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.ninodes > MAXINODES)
+    panic("too many inodes");
+  if(sb.size > FSSIZE)
+    panic("file system too big");
   initlog(dev, &sb);
+  bresinit();
+  imapinit(dev);
 }
 
 // Zero a block.
@@ -52,41 +61,210 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = boverwrite(dev, bno);
   memset(bp->data, 0, BSIZE);
+  bp->valid = 1;
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Where balloc() starts looking when the caller has no better
+// hint: just past the last block it allocated. Like sb, there
+// should be one per disk device.
+static uint bnext;
+
+// Block reservations. So that a file written a little at a
+// time keeps its blocks together even while other files grow,
+// a block that bmap() allocates for a file in a new place comes
+// with a window of up to RESBLOCKS free blocks after it, set
+// aside in memory for that file's next allocations. balloc()
+// skips reserved blocks, unless the disk is otherwise full; then
+// it drops all reservations, and bumps resv.gen so that their
+// owners notice. A file's window is given back when its inode's
+// last reference goes away or the file is truncated.
+#define RESBLOCKS 64
+
+struct {
+  struct spinlock lock;
+  uint gen;
+  uint64 map[(FSSIZE + 63) / 64];  // bit set if block is reserved
+} resv;
+
+static void
+bresinit(void)
+{
+  initlock(&resv.lock, "resv");
+}
+
+#define RESERVED(b) (resv.map[(b)/64] & ((uint64)1 << ((b)%64)))
+
+// Index of the lowest zero bit in w, which must have one.
+int
+ffz(uint64 w)
+{
+  int n = 0;
+
+  w = ~w;
+  if((w & 0xffffffff) == 0){ n += 32; w >>= 32; }
+  if((w & 0xffff) == 0){ n += 16; w >>= 16; }
+  if((w & 0xff) == 0){ n += 8; w >>= 8; }
+  if((w & 0xf) == 0){ n += 4; w >>= 4; }
+  if((w & 0x3) == 0){ n += 2; w >>= 2; }
+  if((w & 0x1) == 0)
+    n += 1;
+  return n;
+}
+
+// Find the first free, unreserved block in [lo, hi), mark it
+// in use and return it, or return 0 if there is none. Scans the
+// bitmap 64 blocks at a time.
 static uint
-balloc(uint dev)
+bfind(uint dev, uint lo, uint hi)
 {
-  int b, bi, m;
+  uint b, bi, end;
+  uint64 w;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  for(b = lo - lo % BPB; b < hi; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    end = min(BPB, hi - b);
+    acquire(&resv.lock);
+    for(bi = b < lo ? lo - b : 0; bi < end; bi = bi - bi % 64 + 64){
+      // count the blocks in this word before bi as in use.
+      w = ((uint64*)bp->data)[bi/64] | (((uint64)1 << (bi % 64)) - 1);
+      w |= resv.map[(b + bi)/64];
+      if(w == ~(uint64)0)
+        continue;
+      bi = bi - bi % 64 + ffz(w);
+      if(bi >= end)
+        break;
+      release(&resv.lock);
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      return b + bi;
     }
+    release(&resv.lock);
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Reserve up to RESBLOCKS free blocks starting at block start,
+// as far as they are free and in the same bitmap block, for
+// ip's next allocations.
+static void
+breserve(struct inode *ip, uint start)
+{
+  struct buf *bp;
+  uint b, end;
+
+  ip->reslen = 0;
+  if(start >= sb.size)
+    return;
+  end = min(sb.size, min(start + RESBLOCKS, start - start % BPB + BPB));
+  bp = bread(ip->dev, BBLOCK(start, sb));
+  acquire(&resv.lock);
+  for(b = start; b < end; b++){
+    if((bp->data[(b%BPB)/8] & (1 << (b%8))) || RESERVED(b))
+      break;
+    resv.map[b/64] |= (uint64)1 << (b%64);
+  }
+  ip->resstart = start;
+  ip->reslen = b - start;
+  ip->resgen = resv.gen;
+  release(&resv.lock);
+  brelse(bp);
+}
+
+// Allocate the next block of ip's reservation window, or
+// return 0 if its reservations have been dropped.
+static uint
+bclaim(struct inode *ip)
+{
+  struct buf *bp;
+  uint b = ip->resstart;
+  int ok;
+
+  bp = bread(ip->dev, BBLOCK(b, sb));
+  acquire(&resv.lock);
+  ok = ip->resgen == resv.gen;
+  if(ok){
+    resv.map[b/64] &= ~((uint64)1 << (b%64));
+    bp->data[(b%BPB)/8] |= 1 << (b%8);  // Mark block in use.
+  }
+  release(&resv.lock);
+  if(ok)
+    log_write(bp);
+  brelse(bp);
+  if(!ok){
+    ip->reslen = 0;
+    return 0;
+  }
+  ip->resstart++;
+  ip->reslen--;
+  return b;
+}
+
+// Give back what is left of ip's reservation window.
+static void
+bunreserve(struct inode *ip)
+{
+  uint b;
+
+  acquire(&resv.lock);
+  if(ip->resgen == resv.gen){
+    for(b = ip->resstart; b < ip->resstart + ip->reslen; b++)
+      resv.map[b/64] &= ~((uint64)1 << (b%64));
+  }
+  ip->reslen = 0;
+  release(&resv.lock);
+}
+
+// Drop all reservations. Returns 0 if there were none.
+static int
+bresdrop(void)
+{
+  int i, any = 0;
+
+  acquire(&resv.lock);
+  for(i = 0; i < NELEM(resv.map); i++){
+    if(resv.map[i])
+      any = 1;
+    resv.map[i] = 0;
+  }
+  resv.gen++;
+  release(&resv.lock);
+  return any;
+}
+
+// Allocate a disk block, preferably the first free one after
+// block near, or after the last one allocated if near is 0.
+// The block is zeroed unless the caller is about to overwrite
+// all of it. returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint near, int zero)
+{
+  uint b, start;
+
+  start = near ? near + 1 : bnext;
+  if(start >= sb.size)
+    start = 0;
+  // block 0 is the boot block, never free.
+  while((b = bfind(dev, start, sb.size)) == 0 && (b = bfind(dev, 0, start)) == 0){
+    if(!bresdrop()){
+      klog("balloc: out of blocks");
+      return 0;
+    }
+  }
+  bnext = b + 1;
+  if(zero)
+    bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -130,11 +308,11 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   may be reused for another inode if ip->ref is zero.
+//   Otherwise ip->ref tracks the number of in-memory
+//   pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry
+//   and increments its ref; iput() decrements ref.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -153,6 +331,11 @@ bfree(int dev, uint b)
 //   iunlock(ip)
 //   iput(ip)
 //
+// Code that only examines an inode and reads its content
+// (readi(), dirlookup()) may use ilockshared() and
+// iunlockshared() instead, so that it runs alongside other
+// such code rather than one at a time.
+//
 // ilock() is separate from iget() so that system calls can
 // get a long-term reference to an inode (as for an open file)
 // and only lock it for short periods (e.g., in read()).
@@ -164,32 +347,172 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The inode table is a hash table keyed by (dev, inum), with a
+// spin-lock per bucket. Since ip->ref indicates whether an entry
+// is in use, and ip->dev and ip->inum indicate which i-node an
+// entry holds, one must hold the lock of the entry's bucket while
+// using any of those fields; changing dev or inum also takes
+// itable.lock. Entries whose ref has fallen to zero stay in the
+// table, on an LRU list protected by itable.lock, so that the
+// next iget() of the same inode can skip reading it from disk.
+// iget() reuses the least recently used of them for a new inode,
+// and adds a page of new entries to the table if there are none.
+// Lock order: bucket lock, then itable.lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 61
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode lru;  // lru.next is the least recently used
+  int n;             // number of entries in the table
 } itable;
 
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;
+} ibucket[NIBUCKET];
+
+static struct ibucket*
+ibucketof(uint dev, uint inum)
+{
+  return &ibucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+// Caller must hold itable.lock.
+static void
+lru_remove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  ip->next = ip->prev = 0;
+}
+
+// Append ip to the LRU list, as the most recently used.
+// Caller must hold itable.lock.
+static void
+lru_append(struct inode *ip)
+{
+  ip->next = &itable.lru;
+  ip->prev = itable.lru.prev;
+  itable.lru.prev->next = ip;
+  itable.lru.prev = ip;
+}
+
+// Add a page of unused entries to the inode table.
+// Caller must hold itable.lock.
+static void
+igrow(void)
+{
+  struct inode *ip, *end;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    panic("iget: no inodes");
+  memset(mem, 0, PGSIZE);
+  end = (struct inode*)mem + PGSIZE / sizeof(*ip);
+  for(ip = (struct inode*)mem; ip < end; ip++){
+    initsleeplock(&ip->lock, "inode");
+    initsleeplock(&ip->maplock, "inode map");
+    lru_append(ip);  // unused: inum 0, in no bucket
+    itable.n++;
+  }
+}
+
+// Which inodes are free, so that ialloc() need not read
+// inode blocks to find one. Built from the disk by fsinit(),
+// then kept up to date by ialloc() and iput().
+struct {
+  struct spinlock lock;
+  uint next;                  // no inode below next is free
+  uint64 used[MAXINODES/64];  // bit set if inode is allocated
+} imap;
+
+static void
+imapinit(int dev)
+{
+  uint inum;
+  struct buf *bp;
+  struct dinode *dip;
+
+  initlock(&imap.lock, "imap");
+  imap.used[0] = 1;  // there is no inode 0
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb));
+    for(; inum < sb.ninodes; inum++){
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type != 0)
+        imap.used[inum/64] |= (uint64)1 << (inum%64);
+      if(inum%IPB == IPB-1)
+        break;
+    }
+    brelse(bp);
+  }
+  imap.next = 1;
+}
+
+// Claim a free inode number in imap, or return 0 if none.
+static uint
+imap_alloc(void)
+{
+  uint inum;
+  uint64 w;
+
+  acquire(&imap.lock);
+  for(inum = imap.next - imap.next%64; inum < sb.ninodes; inum += 64){
+    w = imap.used[inum/64];
+    if(inum < imap.next)
+      w |= ((uint64)1 << (imap.next%64)) - 1;
+    if(w == ~(uint64)0)
+      continue;
+    inum += ffz(w);
+    if(inum >= sb.ninodes)
+      break;
+    imap.used[inum/64] |= (uint64)1 << (inum%64);
+    imap.next = inum + 1;
+    release(&imap.lock);
+    return inum;
+  }
+  imap.next = sb.ninodes;
+  release(&imap.lock);
+  return 0;
+}
+
+// Inode inum is free again.
+static void
+imap_free(uint inum)
+{
+  acquire(&imap.lock);
+  imap.used[inum/64] &= ~((uint64)1 << (inum%64));
+  if(inum < imap.next)
+    imap.next = inum;
+  release(&imap.lock);
+}
+
+static void dcacheinit(void);
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&ibucket[i].lock, "ibucket");
+  itable.lru.next = itable.lru.prev = &itable.lru;
+  acquire(&itable.lock);
+  while(itable.n < NINODE)
+    igrow();
+  release(&itable.lock);
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcache_purge(struct inode *dp);
+static void indfree(struct inode *ip);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -202,20 +525,19 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
+  if((inum = imap_alloc()) == 0){
+    klog("ialloc: no inodes");
+    return 0;
   }
-  printf("ialloc: no inodes\n");
-  return 0;
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -240,38 +562,106 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
-// Find the inode with number inum on device dev
-// and return the in-memory copy. Does not lock
-// the inode and does not read it from disk.
+// Find the inode with number inum on device dev in bucket b,
+// and take a reference to it. Caller must hold b->lock.
 static struct inode*
-iget(uint dev, uint inum)
+ifind(struct ibucket *b, uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
-  acquire(&itable.lock);
+  for(ip = b->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        acquire(&itable.lock);
+        lru_remove(ip);
+        release(&itable.lock);
+      }
+      return ip;
+    }
+  }
+  return 0;
+}
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+// Take the least recently used unreferenced entry out of
+// the inode table, growing the table if there is none.
+static struct inode*
+ireclaim(void)
+{
+  struct inode *ip, **pp;
+  struct ibucket *b;
+  uint dev, inum;
+
+  for(;;){
+    acquire(&itable.lock);
+    if(itable.lru.next == &itable.lru)
+      igrow();
+    ip = itable.lru.next;
+    if(ip->inum == 0){  // in no bucket
+      lru_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    dev = ip->dev;
+    inum = ip->inum;
+    release(&itable.lock);
+
+    // take the locks in order, then check that ip is
+    // still unreferenced and still holds the same inode.
+    b = ibucketof(dev, inum);
+    acquire(&b->lock);
+    acquire(&itable.lock);
+    if(ip->ref == 0 && ip->next != 0 && ip->dev == dev && ip->inum == inum){
+      lru_remove(ip);
+      for(pp = &b->head; *pp != ip; pp = &(*pp)->hnext)
+        ;
+      *pp = ip->hnext;
+      ip->inum = 0;
+      release(&itable.lock);
+      release(&b->lock);
+      return ip;
+    }
+    release(&itable.lock);
+    release(&b->lock);
   }
+}
+
+// Find the inode with number inum on device dev
+// and return the in-memory copy. Does not lock
+// the inode and does not read it from disk.
+static struct inode*
+iget(uint dev, uint inum)
+{
+  struct ibucket *b = ibucketof(dev, inum);
+  struct inode *ip, *new;
+
+  // Is the inode already in the table?
+  acquire(&b->lock);
+  ip = ifind(b, dev, inum);
+  release(&b->lock);
+  if(ip)
+    return ip;
 
   // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  new = ireclaim();
 
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&itable.lock);
+  acquire(&b->lock);
+  if((ip = ifind(b, dev, inum)) != 0){
+    // another process added it meanwhile.
+    acquire(&itable.lock);
+    lru_append(new);
+    release(&itable.lock);
+  } else {
+    ip = new;
+    acquire(&itable.lock);
+    ip->dev = dev;
+    ip->inum = inum;
+    release(&itable.lock);
+    ip->ref = 1;
+    ip->valid = 0;
+    ip->hnext = b->head;
+    b->head = ip;
+  }
+  release(&b->lock);
 
   return ip;
 }
@@ -281,9 +671,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b = ibucketof(ip->dev, ip->inum);
+
+  acquire(&b->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&b->lock);
   return ip;
 }
 
@@ -310,6 +702,9 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->maplen = 0;
+    ip->lastblock = 0;
+    ip->nelfseg = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -326,6 +721,33 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode shared with other readers, for code
+// that does not modify it. Reads the inode from disk if
+// necessary, holding the lock exclusively to do so.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  while(ip->valid == 0){
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleepshared(&ip->lock);
+  }
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
 // be recycled.
@@ -336,7 +758,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *b = ibucketof(ip->dev, ip->inum);
+
+  acquire(&b->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,20 +769,29 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&b->lock);
 
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    dcache_purge(ip);
+    imap_free(ip->inum);
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&b->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(--ip->ref == 0){
+    if(ip->reslen > 0)
+      bunreserve(ip);
+    indfree(ip);
+    acquire(&itable.lock);
+    lru_append(ip);
+    release(&itable.lock);
+  }
+  release(&b->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -374,20 +807,151 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in the NINDIRECT blocks listed in block
+// ip->addrs[NDIRECT+1].
+//
+// ip->mapbn, mapaddr and maplen cache the last run of
+// consecutive blocks found in an indirect block, so that
+// reading a file sequentially does not read its indirect
+// blocks again for every data block.
+//
+// ip->ind, allocated when first needed, holds in-memory copies
+// of up to NINDCACHE of ip's indirect blocks: the indirect
+// block, the doubly-indirect block, and the last of the blocks
+// it lists that was used; ip->indaddr[] says which. bmap() keeps
+// them up to date as it adds blocks, and only itrunc() frees
+// indirect blocks, so a copy stays good until itrunc() or the
+// last iput() drops them.
+//
+// Since readers may hold ip->lock shared, bmap() updates these
+// caches holding ip->maplock.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-// returns 0 if out of disk space.
+#define IND_SINGLE 0  // ip->addrs[NDIRECT]
+#define IND_DOUBLE 1  // ip->addrs[NDIRECT+1]
+#define IND_LEAF   2  // a block listed in ip->addrs[NDIRECT+1]
+
+// Return ip's in-memory copy of indirect block addr, loading
+// it into slot if need be, or 0 if there is no memory for it.
+static uint*
+indcache(struct inode *ip, int slot, uint addr)
+{
+  struct buf *bp;
+  uint *a;
+
+  if(ip->ind == 0){
+    if((ip->ind = kalloc()) == 0)
+      return 0;
+    memset(ip->indaddr, 0, sizeof(ip->indaddr));
+  }
+  a = (uint*)ip->ind + slot * NINDIRECT;
+  if(ip->indaddr[slot] != addr){
+    bp = bread(ip->dev, addr);
+    memmove(a, bp->data, BSIZE);
+    brelse(bp);
+    ip->indaddr[slot] = addr;
+  }
+  return a;
+}
+
+// Drop ip's copies of its indirect blocks.
+static void
+indfree(struct inode *ip)
+{
+  if(ip->ind){
+    kfree(ip->ind);
+    ip->ind = 0;
+  }
+}
+
+// Load the run of consecutive blocks starting at entry bn of
+// indirect block array a, which is file block lbn at addr, into
+// ip's block map cache.
+static void
+maprun(struct inode *ip, uint *a, uint bn, uint lbn, uint addr)
+{
+  uint n;
+
+  for(n = 1; bn + n < NINDIRECT && a[bn+n] == addr + n; n++)
+    ;
+  ip->mapbn = lbn;
+  ip->mapaddr = addr;
+  ip->maplen = n;
+}
+
+// Allocate a block for ip from its reservation window, or
+// else next to the last one allocated for it if possible,
+// reserving a new window after it, so that its blocks stay
+// together.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap_alloc(struct inode *ip, int zero)
 {
-  uint addr, *a;
+  uint addr = 0;
+
+  if(ip->reslen > 0 && (addr = bclaim(ip)) != 0){
+    if(zero)
+      bzero(ip->dev, addr);
+  } else if((addr = balloc(ip->dev, ip->lastblock, zero)) != 0){
+    breserve(ip, addr + 1);
+  }
+  if(addr)
+    ip->lastblock = addr;
+  return addr;
+}
+
+// Return entry bn of the indirect block at *ap, allocating
+// the indirect block and the entry as needed; the caller
+// saves *ap if it changes. The indirect block's in-memory copy
+// goes in slot of ip->ind. If lbn is not -1, entry bn is
+// file block lbn, and the run of blocks it starts is loaded
+// into ip's block map cache. Returns 0 if out of disk space.
+// overwrite is as for bmap().
+static uint
+bmap_ind(struct inode *ip, uint *ap, uint bn, uint lbn, int overwrite, int slot)
+{
+  uint addr, *a, *c;
   struct buf *bp;
 
+  if((addr = *ap) == 0){
+    addr = bmap_alloc(ip, 1);
+    if(addr == 0)
+      return 0;
+    *ap = addr;
+  }
+  if((c = indcache(ip, slot, addr)) != 0 && c[bn] != 0){
+    if(lbn != -1)
+      maprun(ip, c, bn, lbn, c[bn]);
+    return c[bn];
+  }
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn]) == 0){
+    addr = bmap_alloc(ip, !(overwrite && lbn != -1));
+    if(addr){
+      a[bn] = addr;
+      log_write(bp);
+      if(c)
+        c[bn] = addr;
+    }
+  }
+  if(addr && lbn != -1)
+    maprun(ip, a, bn, lbn, addr);
+  brelse(bp);
+  return addr;
+}
+
+static uint
+bmap_locked(struct inode *ip, uint bn, int overwrite)
+{
+  uint addr, lbn = bn;
+
+  if(bn - ip->mapbn < ip->maplen)
+    return ip->mapaddr + (bn - ip->mapbn);
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = bmap_alloc(ip, !overwrite);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -396,38 +960,76 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+  if(bn < NINDIRECT)
+    return bmap_ind(ip, &ip->addrs[NDIRECT], bn, lbn, overwrite, IND_SINGLE);
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Find the indirect block that lists block bn.
+    addr = bmap_ind(ip, &ip->addrs[NDIRECT+1], bn / NINDIRECT, -1, 0, IND_DOUBLE);
+    if(addr == 0)
+      return 0;
+    return bmap_ind(ip, &addr, bn % NINDIRECT, lbn, overwrite, IND_LEAF);
   }
 
   panic("bmap: out of range");
 }
 
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one, zeroed unless
+// overwrite says the caller is about to write all of it.
+// returns 0 if out of disk space.
+static uint
+bmap(struct inode *ip, uint bn, int overwrite)
+{
+  uint addr;
+
+  acquiresleep(&ip->maplock);
+  addr = bmap_locked(ip, bn, overwrite);
+  releasesleep(&ip->maplock);
+  return addr;
+}
+
+// Free the blocks listed in indirect block addr, then addr.
+// If depth is 1, those are themselves indirect blocks.
+static void
+itrunc_ind(struct inode *ip, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      itrunc_ind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
+// Freeing a file's blocks, however many, writes only bitmap
+// blocks and the inode's block, so the log space begin_op()
+// reserves covers it as long as that includes every bitmap
+// block, along with the directory and inode blocks that the
+// unlink() that leads to the truncation writes.
+#if FSSIZE/BPB + 1 + 3 > MAXOPBLOCKS
+#error "MAXOPBLOCKS too small to free a file; shrink FSSIZE"
+#endif
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  ip->nelfseg = 0;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -437,17 +1039,18 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    itrunc_ind(ip, ip->addrs[NDIRECT], 0);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    itrunc_ind(ip, ip->addrs[NDIRECT+1], 1);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  bunreserve(ip);
+  indfree(ip);
+  ip->maplen = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -480,7 +1083,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 0);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -495,6 +1098,41 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Read data from inode straight from the buffer cache into
+// pipe pi, as far as pi has room; like readi(), but does not
+// wait for the pipe's reader, so the caller may hold ip->lock.
+// Returns the number of bytes moved, or -1 if pi's read end
+// is closed.
+int
+readipipe(struct inode *ip, struct pipe *pi, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    uint addr = bmap(ip, off/BSIZE, 0);
+    if(addr == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(pi, (char*)bp->data + (off % BSIZE), m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -512,17 +1150,20 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  ip->nelfseg = 0;  // exec must parse the new contents
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    // a whole block needs neither zeroing nor reading first.
+    uint addr = bmap(ip, off/BSIZE, m == BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
+    bp = m == BSIZE ? boverwrite(ip->dev, addr) : bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
+    bp->valid = 1;
     log_write(bp);
     brelse(bp);
   }
@@ -546,31 +1187,421 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Name cache.
+//
+// The name cache remembers the results of recent directory
+// lookups: for (directory, name) either the entry's inode
+// number and offset, or that the name is not present (inum 0).
+// It lets namex() walk a path without locking or reading the
+// directories along the way.
+//
+// An entry is only added or changed by a thread holding the
+// directory's lock, right after it reads or writes the directory
+// entry, so the cache agrees with the directory. dirlink() and
+// sys_unlink() update it as they change a directory, and iput()
+// drops a directory's entries when it frees the directory, since
+// the inode number may be reused. The cache is a set-associative
+// hash table, with least-recently-used replacement in each set.
+
+#define DCWAYS 4
+
+struct dentry {
+  uint dev;
+  uint dinum;       // directory's inode number; 0 if unused
+  char name[DIRSIZ];
+  uint inum;        // 0 if name is not in the directory
+  uint off;         // byte offset of the entry, if inum != 0
+  uint used;        // for LRU
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dentry d[NDCACHE];
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// First entry of the set that may hold (dp, name).
+static struct dentry*
+dcache_set(struct inode *dp, char *name)
+{
+  uint h = dp->dev * 31 + dp->inum;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return &dcache.d[(h % (NDCACHE / DCWAYS)) * DCWAYS];
+}
+
+// Find (dp, name). Caller must hold dcache.lock.
+static struct dentry*
+dcache_find(struct inode *dp, char *name)
+{
+  struct dentry *d, *set = dcache_set(dp, name);
+
+  for(d = set; d < set + DCWAYS; d++){
+    if(d->dinum == dp->inum && d->dev == dp->dev && namecmp(name, d->name) == 0){
+      d->used = ++dcache.clock;
+      return d;
+    }
+  }
+  return 0;
+}
+
+// Look up name in directory dp in the name cache.
+// Returns 0 if the cache does not know. Otherwise returns 1
+// and sets *ipp to the entry's inode, from iget(), or to 0
+// if the name is not present; *poff is set as in dirlookup().
+static int
+dcache_lookup(struct inode *dp, char *name, struct inode **ipp, uint *poff)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcache_find(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  // get the reference before releasing the lock, so that the
+  // inode cannot be unlinked and freed in between.
+  *ipp = d->inum ? iget(dp->dev, d->inum) : 0;
+  if(poff)
+    *poff = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp is inode inum at offset off,
+// or is not present if inum is 0. Caller must hold dp->lock.
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, *set;
+
+  acquire(&dcache.lock);
+  if((d = dcache_find(dp, name)) == 0){
+    // reuse a free entry, or else the least recently used.
+    set = dcache_set(dp, name);
+    d = set;
+    for(struct dentry *e = set + 1; e < set + DCWAYS; e++)
+      if(d->dinum != 0 && (e->dinum == 0 || e->used < d->used))
+        d = e;
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->used = ++dcache.clock;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// The entry for name has been cleared from directory dp.
+// Caller must hold dp->lock.
+void
+dcache_unlink(struct inode *dp, char *name)
+{
+  dcache_enter(dp, name, 0, 0);
+}
+
+// Forget all entries of directory dp, which is being freed
+// or whose entries have moved.
+static void
+dcache_purge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.d; d < dcache.d + NDCACHE; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev)
+      d->dinum = 0;
+  release(&dcache.lock);
+}
+
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Read block fb of directory dp.
+static struct buf*
+dirblock(struct inode *dp, uint fb)
+{
+  uint addr;
+
+  if((addr = bmap(dp, fb, 0)) == 0)
+    panic("dirblock");
+  return bread(dp->dev, addr);
+}
+
+// Add a zeroed block to the end of directory dp.
+// Returns its block number within dp, or -1 if out of disk space.
+static int
+dirnewblock(struct inode *dp)
+{
+  uint fb = dp->size / BSIZE;
+
+  if(fb > 0xffff || bmap(dp, fb, 0) == 0)  // balloc() zeroes it
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return fb;
+}
+
+// Entry k of the hashed directory table in bp.
+static ushort*
+dirtab(struct buf *bp, uint k)
+{
+  struct dirent *de = (struct dirent*)bp->data + 1 + k / DIRTABPER;
+
+  return (ushort*)de->name + k % DIRTABPER;
+}
+
+// The first block of the bucket for hash h in hashed directory dp.
+static uint
+dirbucket(struct inode *dp, uint h)
+{
+  struct buf *bp;
+  uint fb;
+
+  bp = dirblock(dp, 0);
+  fb = *dirtab(bp, h % (1 << ((struct dirhdr*)bp->data)->depth));
+  brelse(bp);
+  return fb;
+}
+
+// Make the new, empty directory dp hashed, with one bucket,
+// or linear if hashed is 0. Returns -1 if out of disk space.
+int
+dirinit(struct inode *dp, int hashed)
+{
+  struct buf *bp;
+
+  if(dp->size != 0)
+    panic("dirinit");
+  if(!hashed)
+    return 0;
+  dp->major = 1;
+  if(dirnewblock(dp) < 0 || dirnewblock(dp) < 0)
+    return -1;
+  bp = dirblock(dp, 0);
+  *dirtab(bp, 0) = 1;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Scan block fb of directory dp for name, as dirscan() does.
+// If pnext is not 0, the block is a bucket of a hashed directory,
+// and *pnext is set to the next block in its chain.
+static uint
+dirscanblock(struct inode *dp, uint fb, char *name, uint *poff, uint *pfree, uint *pnext)
+{
+  uint off, inum;
+  struct buf *bp;
+  struct dirent *de, *end;
+
+  off = fb * BSIZE;
+  bp = dirblock(dp, fb);
+  de = (struct dirent*)bp->data;
+  end = de + min(BSIZE, dp->size - off) / sizeof(*de);
+  if(pnext){
+    *pnext = ((struct dirhdr*)bp->data)->next;
+    de++;
+  }
+  for(; de < end; de++){
+    if(de->inum == 0){
+      if(pfree && *pfree == dp->size)
+        *pfree = off + ((char*)de - (char*)bp->data);
+      continue;
+    }
+    if(namecmp(name, de->name) == 0){
+      // entry matches path element
+      *poff = off + ((char*)de - (char*)bp->data);
+      inum = de->inum;
+      brelse(bp);
+      return inum;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Scan directory dp for name a block at a time, comparing
+// names in place in the buffer cache. A linear directory is
+// scanned from the start; a hashed one only in name's bucket.
+// If found, set *poff to byte offset of entry and return its
+// inode number; otherwise return 0. If pfree is not 0 and name
+// is not found, set *pfree to the offset of the first free
+// entry, or dp->size if none.
+static uint
+dirscan(struct inode *dp, char *name, uint *poff, uint *pfree)
+{
+  uint fb, nb, next, inum;
+
+  if(pfree)
+    *pfree = dp->size;
+  if(dp->major == 0){
+    nb = (dp->size + BSIZE - 1) / BSIZE;
+    for(fb = 0; fb < nb; fb++)
+      if((inum = dirscanblock(dp, fb, name, poff, pfree, 0)) != 0)
+        return inum;
+    return 0;
+  }
+  for(fb = dirbucket(dp, dirhash(name)); ; fb = next){
+    if((inum = dirscanblock(dp, fb, name, poff, pfree, &next)) != 0)
+      return inum;
+    if(next == 0)
+      return 0;
+  }
+}
+
+// Make room for name in its bucket of hashed directory dp, which
+// is full, and set *poff to a free entry. Splits the bucket if
+// split is set and the bucket can split; otherwise, or if name's
+// half is still full, chains an overflow block after the bucket.
+// Adds at most two blocks, so that a dirlink() fits in one
+// transaction. Returns -1 if out of disk space.
+static int
+dirgrow(struct inode *dp, char *name, uint *poff, int split)
+{
+  uint h, fb, d, k, n;
+  int nfb;
+  struct buf *tp, *bp, *np, *xp;
+  struct dirhdr *th, *bh;
+  struct dirent *de, *nde;
+
+  // allocate first: bmap() must not wait for dp's blocks.
+  if((nfb = dirnewblock(dp)) < 0)
+    return -1;
+  h = dirhash(name);
+  tp = dirblock(dp, 0);
+  th = (struct dirhdr*)tp->data;
+  fb = *dirtab(tp, h % (1 << th->depth));
+  bp = dirblock(dp, fb);
+  bh = (struct dirhdr*)bp->data;
+  d = bh->depth;
+
+  if(!split || bh->next != 0 || d == MAXDIRDEPTH){
+    // chain nfb after the bucket's last block.
+    brelse(tp);
+    while(bh->next != 0){
+      fb = bh->next;
+      brelse(bp);
+      bp = dirblock(dp, fb);
+      bh = (struct dirhdr*)bp->data;
+    }
+    bh->next = nfb;
+    log_write(bp);
+    brelse(bp);
+    *poff = nfb * BSIZE + sizeof(struct dirent);
+    return 0;
+  }
+
+  // split: nfb takes the entries with bit d of the hash set.
+  np = dirblock(dp, nfb);
+  if(d == th->depth){
+    for(k = 0; k < (1 << d); k++)
+      *dirtab(tp, k + (1 << d)) = *dirtab(tp, k);
+    th->depth++;
+  }
+  for(k = 0; k < (1 << th->depth); k++)
+    if(*dirtab(tp, k) == fb && ((k >> d) & 1))
+      *dirtab(tp, k) = nfb;
+  bh->depth = d + 1;
+  ((struct dirhdr*)np->data)->depth = d + 1;
+  nde = (struct dirent*)np->data + 1;
+  for(de = (struct dirent*)bp->data + 1; de < (struct dirent*)(bp->data + BSIZE); de++){
+    if(de->inum != 0 && ((dirhash(de->name) >> d) & 1)){
+      *nde++ = *de;
+      memset(de, 0, sizeof(*de));
+    }
+  }
+  log_write(tp);
+  log_write(bp);
+  log_write(np);
+  brelse(tp);
+  // entries moved, so forget their cached offsets.
+  dcache_purge(dp);
+
+  if((h >> d) & 1){
+    xp = np;
+    fb = nfb;
+  } else {
+    xp = bp;
+  }
+  *poff = 0;
+  de = (struct dirent*)xp->data + 1;
+  for(n = 1; n < BSIZE / sizeof(*de); n++, de++){
+    if(de->inum == 0){
+      *poff = fb * BSIZE + n * sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  brelse(np);
+  if(*poff == 0)
+    return dirgrow(dp, name, poff, 0);
+  return 0;
+}
+
+// Is the directory dp empty except for "." and ".."?
+// Scans a block at a time, as dirscan() does.
+int
+isdirempty(struct inode *dp)
+{
+  uint off;
+  struct buf *bp;
+  struct dirent *de, *end;
+
+  for(off = 0; off < dp->size; off += BSIZE){
+    bp = dirblock(dp, off / BSIZE);
+    de = (struct dirent*)bp->data;
+    end = de + min(BSIZE, dp->size - off) / sizeof(*de);
+    for(; de < end; de++){
+      if(de->inum != 0 && namecmp(de->name, ".") != 0 && namecmp(de->name, "..") != 0){
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+  }
+  return 1;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  struct inode *ip;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(dcache_lookup(dp, name, &ip, poff))
+    return ip;
+
+  if((inum = dirscan(dp, name, &off, 0)) != 0){
+    if(poff)
+      *poff = off;
+    dcache_enter(dp, name, inum, off);
+    return iget(dp->dev, inum);
   }
 
+  dcache_enter(dp, name, 0, 0);
   return 0;
 }
 
@@ -579,28 +1610,20 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off;
   struct dirent de;
-  struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  // Check that name is not present, and look for an empty dirent.
+  if(dirscan(dp, name, &off, &off) != 0)
+    return -1;
+  if(dp->major > 0 && off == dp->size && dirgrow(dp, name, &off, 1) < 0)
     return -1;
-  }
-
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
@@ -652,28 +1675,42 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct fdtable *t;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    t = myproc()->fdt;
+    acquire(&t->lock);  // another thread may chdir
+    ip = idup(t->cwd);
+    release(&t->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // only directories have entries in the name cache, so
+    // a hit needs neither ip's lock nor its type.
+    if(!(nameiparent && *path == '\0') && dcache_lookup(ip, name, &next, 0)){
+      iput(ip);
+      if((ip = next) == 0)
+        return 0;
+      continue;
+    }
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
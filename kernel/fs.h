@@ -24,18 +24,29 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define MAXINODES 65536  // a dirent's inum is a ushort
+
+// The log is a head block followed by transactions, each a
+// descriptor (four words, then a block number and a checksum
+// per logged block) and up to LOGSIZE logged blocks. It has
+// room for two of the largest transactions.
+#define LOGDESCBLOCKS ((sizeof(uint) * (4 + 2*LOGSIZE) + BSIZE - 1) / BSIZE)
+#define LOGBLOCKS     (1 + 2 * (LOGDESCBLOCKS + LOGSIZE))
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE only),
+                        // or 1 if hashed (T_DIR only)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -53,6 +64,30 @@ struct dinode {
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
+// A directory is either linear, or hashed if its inode's major is
+// 1. Block 0 of a hashed directory is a table of 2^depth entries,
+// each the block number within the directory of a bucket, a block
+// of dirents; a name goes in bucket entry dirhash(name) % 2^depth,
+// where dirhash is 32-bit FNV-1a over the name's bytes. A bucket
+// whose own depth is below the table's has several entries. A full
+// bucket splits in two by the next bit of the hash, doubling the
+// table if it must, or, if it is at MAXDIRDEPTH or has split
+// before without making room, gets overflow blocks chained after
+// it. Slot 0 of each block is a struct dirhdr, and table entries
+// fill the name bytes of the table's other slots, so that every
+// dirent of a hashed directory but its entries has inum 0.
+#define MAXDIRDEPTH 8
+
+struct dirhdr {
+  ushort inum;     // always 0
+  ushort depth;    // table's depth, or bucket's own depth
+  ushort next;     // next overflow block of a bucket, or 0
+  char pad[DIRSIZ - 2*sizeof(ushort)];
+};
+
+// table entries per dirent slot
+#define DIRTABPER (DIRSIZ / sizeof(ushort))
+
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
@@ -0,0 +1,116 @@
+//
+// Kernel log: records that klog() adds, kept in memory for
+// klog_read() instead of being printed.
+//
+// Each CPU adds records only to its own ring, with interrupts
+// off, so adding one takes no lock: the CPU fills in the slot
+// and then advances head. A reader copies a record and then
+// checks that head has not since come round to the record's
+// slot again; if it has, the record was overwritten and the
+// reader skips ahead. klogbuf.lock serializes readers only.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "klog.h"
+
+#define KLOGRECS 64  // records per CPU; a power of 2
+
+struct klogcpu {
+  struct klogrec rec[KLOGRECS];
+  uint head;  // # of records added, written only by this CPU
+  uint tail;  // next record to read, protected by klog.lock
+};
+
+struct {
+  struct spinlock lock;
+  struct klogcpu cpu[NCPU];
+} klogbuf;
+
+void
+kloginit(void)
+{
+  initlock(&klogbuf.lock, "klog");
+}
+
+// Add message msg, of n characters, to this CPU's ring.
+void
+klogwrite(char *msg, int n)
+{
+  struct klogcpu *c;
+  struct klogrec *r;
+
+  push_off();
+  c = &klogbuf.cpu[cpuid()];
+  r = &c->rec[c->head % KLOGRECS];
+  // a reader must not see this record's stores before the
+  // previous advance of head, which tells it the slot is
+  // being reused.
+  __sync_synchronize();
+  r->time = r_time();
+  r->cpu = cpuid();
+  r->len = n;
+  memmove(r->msg, msg, n + 1);
+  __atomic_store_n(&c->head, c->head + 1, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// Copy the oldest unread record of c into r, skipping any
+// that have been overwritten. Returns 0 if there is none.
+// Caller holds klog.lock.
+static int
+klogpeek(struct klogcpu *c, struct klogrec *r)
+{
+  uint head;
+
+  for(;;){
+    // while the CPU adds record head, slot head % KLOGRECS
+    // is not a whole record.
+    head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+    if(head - c->tail >= KLOGRECS)
+      c->tail = head - KLOGRECS + 1;
+    if(c->tail == head)
+      return 0;
+    *r = c->rec[c->tail % KLOGRECS];
+    // finish copying the record before looking at head again,
+    // as klogwrite() orders its stores around head.
+    __sync_synchronize();
+    head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+    if(head - c->tail < KLOGRECS)
+      return 1;
+  }
+}
+
+// Remove up to n records from the log, oldest first, and
+// copy them to user address dst. Returns the number copied,
+// or -1 on a bad address.
+int
+klogread(uint64 dst, int n)
+{
+  struct klogrec r, best;
+  int i, id, bestid;
+
+  acquire(&klogbuf.lock);
+  for(i = 0; i < n; i++){
+    bestid = -1;
+    for(id = 0; id < NCPU; id++){
+      if(klogpeek(&klogbuf.cpu[id], &r) && (bestid < 0 || r.time < best.time)){
+        best = r;
+        bestid = id;
+      }
+    }
+    if(bestid < 0)
+      break;
+    if(copyout(myproc()->pagetable, dst + i*sizeof(best), (char*)&best, sizeof(best)) < 0){
+      release(&klogbuf.lock);
+      return -1;
+    }
+    klogbuf.cpu[bestid].tail++;
+  }
+  release(&klogbuf.lock);
+  return i;
+}
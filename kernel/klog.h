@@ -0,0 +1,9 @@
+// A kernel log record, as klog_read() returns them.
+#define KLOGMSG 48  // message size, including the terminating 0
+
+struct klogrec {
+  uint64 time;        // r_time() when logged
+  int cpu;            // CPU that logged it
+  int len;            // strlen(msg)
+  char msg[KLOGMSG];
+};
@@ -10,52 +10,163 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction is sealed only when there are no FS
+// system calls active in it. Thus there is never any reasoning
+// required about whether a commit might write an uncommitted
+// system call's updates to disk.
+//
+// The log is double-buffered: at most one sealed transaction is
+// being committed while a second, open transaction accepts new
+// FS system calls. The committer holds the sealed transaction's
+// cached blocks locked while it writes them to the log, so the
+// open transaction can proceed with everything else. System
+// calls that arrive during a commit are grouped into the next
+// transaction, which the committer picks up as soon as the disk
+// is free.
+//
+// Committed blocks are not copied to their home locations right
+// away. They stay pinned in the buffer cache and the log keeps
+// accumulating transactions until the next one would not fit;
+// only then does checkpoint() write each logged block home once,
+// straight from the cache, and empty the log. A block that is
+// logged by many transactions (a bitmap or inode block, say) is
+// thus written home once per checkpoint rather than once per
+// transaction.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls, reserves
+// MAXOPBLOCKS blocks of log space and returns. But if it
+// thinks the open transaction is close to running out of
+// log space, it sleeps until that transaction commits.
+// System calls that write more, such as a large write(),
+// reserve what they need with begin_opn()/end_opn().
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
+//   head block, containing the sequence # of the first transaction
+//   transaction, sequence # s:
+//     descriptor block(s), containing s, the count, and
+//       block # and checksum for block A, B, C, ...
+//     block A
+//     block B
+//     block C
+//     ...
+//   transaction, sequence # s+1:
+//     ...
+// A transaction's descriptor and blocks are written with gather
+// writes of up to NUM/2-2 blocks each, so a large transaction
+// takes several disk requests, one after another. The blocks may
+// reach the disk in any order; the transaction is committed once
+// all of them have. Recovery replays transactions in sequence
+// order and stops at the first whose descriptor or blocks do not
+// match their checksums, so a transaction cut short between
+// requests is ignored, and no separate commit record, and no
+// erasing of the log, is needed. Only checkpoint() rewrites the
+// head block, to skip the transactions it installed.
 // Log appends are synchronous.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+#define LOGMAGIC 0x10c0ffee
+
+// Contents of the log head block.
+struct loghead {
+  uint magic;
+  uint seq;    // sequence # of the first transaction in the log
+};
+
+// Transaction descriptor, at the start of each transaction.
+struct logdesc {
+  uint magic;
+  uint seq;    // sequence # of this transaction
+  uint n;      // number of logged blocks that follow
+  uint cksum;  // of the first descsize(n) bytes, with cksum = 0
+  struct {
+    uint blockno;  // home location
+    uint cksum;    // of the logged copy
+  } e[LOGSIZE];
+};
+
+// Block # of the sealed or open transaction's blocks.
 struct logheader {
   int n;
   int block[LOGSIZE];
 };
 
+// A committed copy of a block that has not been installed.
+struct logcopy {
+  int blockno;  // home location
+  int lbn;      // log block holding the copy
+};
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by outstanding sys calls.
+  int committing;  // a sealed transaction is being written out.
+  int sealing;     // open transaction must drain; no new sys calls.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // open transaction
+  struct logheader clh; // sealed transaction, in commit()
+
+  // after the head block; owned by the committer.
+  uint seq;        // sequence # of the next transaction
+  int tail;        // where it goes, relative to start+1
+  int ncopy;
+  struct logcopy copy[LOGBLOCKS]; // committed, not yet installed
 };
 struct log log;
 
+// The descriptor and the sealed transaction's cached blocks,
+// in the order commit() writes them. The cached blocks are held
+// locked while they are written.
+static struct buf descbufs[LOGDESCBLOCKS];
+static struct buf *logbufs[LOGDESCBLOCKS+LOGSIZE];
+static struct logdesc desc;
+
+// For reading log blocks during recovery and checkpoint.
+// Log blocks are written straight from the buffers they log,
+// never through the cache, so they are read around it too.
+static struct buf logscratch;
+
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
+
+// Size of a descriptor of n entries, in bytes and in blocks.
+static int
+descsize(int n)
+{
+  return sizeof(desc) - sizeof(desc.e) + n * sizeof(desc.e[0]);
+}
+
+static int
+descblocks(int n)
+{
+  return (descsize(n) + BSIZE - 1) / BSIZE;
+}
+
+// A cheap checksum, good enough to tell a block that
+// was written from one that was not.
+static uint
+cksum(void *p, int n)
+{
+  uint *w = (uint *) p;
+  uint h = 2166136261;
+  int i;
+
+  for (i = 0; i < n / sizeof(uint); i++)
+    h = (h ^ w[i]) * 16777619;
+  return h;
+}
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  if (sizeof(struct logdesc) > LOGDESCBLOCKS*BSIZE)
+    panic("initlog: too big logdesc");
+  if (sb->nlog < 1 + LOGDESCBLOCKS + LOGSIZE || sb->nlog > LOGBLOCKS)
+    panic("initlog: bad log size");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
@@ -64,142 +175,286 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Read log block lbn into logscratch.
 static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+read_logblock(int lbn)
+{
+  logscratch.dev = log.dev;
+  logscratch.blockno = lbn;
+  virtio_disk_rw(&logscratch, 0);
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Read the descriptor of the transaction at tail into desc and
+// check it. Returns the number of blocks it logs, or -1 if
+// there is no valid transaction with sequence # seq there.
+static int
+read_desc(int tail, uint seq)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  int i, nb;
+  uint sum;
+
+  if (tail + 1 > log.size - 1)
+    return -1;
+  read_logblock(log.start+1+tail);
+  memmove(&desc, logscratch.data, BSIZE);
+  if (desc.magic != LOGMAGIC || desc.seq != seq || desc.n > LOGSIZE)
+    return -1;
+  nb = descblocks(desc.n);
+  if (tail + nb + desc.n > log.size - 1)
+    return -1;
+  for (i = 1; i < nb; i++) {
+    read_logblock(log.start+1+tail+i);
+    memmove((char *) &desc + i*BSIZE, logscratch.data,
+            i == nb-1 ? descsize(desc.n) - i*BSIZE : BSIZE);
   }
-  brelse(buf);
+  sum = desc.cksum;
+  desc.cksum = 0;
+  if (cksum(&desc, descsize(desc.n)) != sum)
+    return -1;
+  return desc.n;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the log head, starting the log over at sequence # seq.
 static void
-write_head(void)
+write_head(uint seq)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct loghead *hb = (struct loghead *) (buf->data);
+  hb->magic = LOGMAGIC;
+  hb->seq = seq;
   bwrite(buf);
   brelse(buf);
 }
 
+// Replay every committed transaction to the home locations
+// of its blocks, then empty the log.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *buf = bread(log.dev, log.start);
+  struct loghead *lh = (struct loghead *) (buf->data);
+  uint seq = lh->magic == LOGMAGIC ? lh->seq : 1;
+  int tail, n, i;
+
+  brelse(buf);
+
+  for (tail = 0; (n = read_desc(tail, seq)) >= 0; tail += descblocks(n) + n, seq++) {
+    int lbn = log.start+1+tail+descblocks(n);
+
+    // a transaction counts only if all of its blocks made it.
+    for (i = 0; i < n; i++) {
+      read_logblock(lbn+i);
+      if (cksum(logscratch.data, BSIZE) != desc.e[i].cksum)
+        break;
+    }
+    if (i < n)
+      break;
+
+    for (i = 0; i < n; i++) {
+      read_logblock(lbn+i);
+      struct buf *dbuf = bread(log.dev, desc.e[i].blockno); // read dst
+      memmove(dbuf->data, logscratch.data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(dbuf);
+    }
+  }
+
+  log.seq = seq;
+  log.tail = 0;
+  log.ncopy = 0;
+  write_head(log.seq); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of an FS system call that
+// may write up to nblocks distinct blocks.
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
+  if(nblocks < 1 || nblocks > LOGSIZE)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.sealing){
+      // the open transaction is draining so it can commit.
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + nblocks > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
 {
-  int do_commit = 0;
+  begin_opn(MAXOPBLOCKS);
+}
 
+// called at the end of an FS system call that began with
+// begin_opn(nblocks).
+// commits if this was the last outstanding operation
+// and the disk is not busy with the previous transaction.
+// otherwise the open transaction is left for the
+// process that is committing to pick up.
+void
+end_opn(int nblocks)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.reserved -= nblocks;
+  if(log.outstanding < 0 || log.reserved < 0)
+    panic("end_op");
+
+  while(log.outstanding == 0 && log.lh.n > 0 && !log.committing){
+    commit();
+    if(log.outstanding > 0 && log.lh.n > 0){
+      // sys calls joined while we were writing; stop new
+      // ones from joining so the last of them commits soon.
+      log.sealing = 1;
+    }
   }
+  if(log.outstanding == 0 && log.lh.n == 0)
+    log.sealing = 0;
+
+  // begin_op() may be waiting for log space, and decrementing
+  // log.reserved has decreased the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Is block # blockno part of the sealed transaction?
+static int
+in_sealed(int blockno)
+{
+  int i;
+
+  for (i = 0; i < log.clh.n; i++)
+    if (log.clh.block[i] == blockno)
+      return 1;
+  return 0;
+}
+
+// Write every committed block home and empty the log.
+// Called by commit() while the sealed transaction is not yet
+// written and no FS sys call is active, so a cached block holds
+// exactly its last committed contents, unless the sealed
+// transaction has modified it since; such a block is installed
+// from its last copy in the log instead.
+static void
+checkpoint(void)
+{
+  int c, i;
+
+  for (c = 0; c < log.ncopy; c++) {
+    int blockno = log.copy[c].blockno;
+    struct buf *dbuf = bread(log.dev, blockno);
+
+    for (i = c + 1; i < log.ncopy; i++)
+      if (log.copy[i].blockno == blockno)
+        break;
+    if (i == log.ncopy) {  // last copy of this block in the log?
+      if (in_sealed(blockno)) {
+        read_logblock(log.copy[c].lbn);
+        logscratch.blockno = blockno;
+        virtio_disk_rw(&logscratch, 1);
+      } else {
+        bwrite(dbuf);  // write dst to disk, straight from the cache
+      }
+    }
+    bunpin(dbuf);  // one pin per logged copy
+    brelse(dbuf);
   }
+  log.ncopy = 0;
+  log.tail = 0;
+  write_head(log.seq);  // Skip the installed transactions
 }
 
-// Copy modified blocks from cache to log.
+// Write the descriptor and the sealed transaction's blocks to
+// the log with virtio_disk_writev(), which issues as few gather
+// writes as the descriptor ring allows, the blocks straight from
+// the locked cache buffers. When this returns, the transaction
+// has committed.
 static void
 write_log(void)
 {
-  int tail;
+  int i, nb = descblocks(log.clh.n);
+
+  memset(&desc, 0, descsize(log.clh.n));
+  desc.magic = LOGMAGIC;
+  desc.seq = log.seq;
+  desc.n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    desc.e[i].blockno = log.clh.block[i];
+    desc.e[i].cksum = cksum(logbufs[nb+i]->data, BSIZE);
+  }
+  desc.cksum = cksum(&desc, descsize(desc.n));
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (i = 0; i < nb; i++) {
+    memmove(descbufs[i].data, (char *) &desc + i*BSIZE,
+            i == nb-1 ? descsize(desc.n) - i*BSIZE : BSIZE);
+    logbufs[i] = &descbufs[i];
   }
+  virtio_disk_writev(logbufs, nb + log.clh.n, log.start+1+log.tail);
 }
 
+// Seal the open transaction and commit it. Must be called with
+// log.lock held, no outstanding sys calls and no commit in
+// progress. Releases log.lock while writing, so the next
+// transaction can begin as soon as the sealed transaction's
+// blocks are locked.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+commit(void)
+{
+  int tail, nb;
+
+  log.committing = 1;
+  log.sealing = 1;
+  log.clh = log.lh;
+  release(&log.lock);
+
+  nb = descblocks(log.clh.n);
+  if (log.tail + nb + log.clh.n > log.size - 1)
+    checkpoint();   // Log is full: install what it holds
+
+  // No FS sys call is active, so nobody else holds these
+  // buffers except briefly, to read them.
+  for (tail = 0; tail < log.clh.n; tail++)
+    logbufs[nb+tail] = bread(log.dev, log.clh.block[tail]);
+
+  acquire(&log.lock);
+  log.lh.n = 0;
+  log.sealing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log();     // Write descriptor and blocks -- the real commit
+  for (tail = 0; tail < log.clh.n; tail++) {
+    brelse(logbufs[nb+tail]);  // still pinned until checkpoint()
+    log.copy[log.ncopy].blockno = log.clh.block[tail];
+    log.copy[log.ncopy].lbn = log.start+1+log.tail+nb+tail;
+    log.ncopy++;
   }
+  log.tail += nb + log.clh.n;
+  log.seq++;
+  log.clh.n = 0;
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -217,7 +472,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= LOGSIZE)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -233,4 +488,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
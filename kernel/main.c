@@ -12,7 +12,7 @@ main()
 {
   if(cpuid() == 0){
     consoleinit();
-    printfinit();
+    kloginit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
@@ -27,6 +27,7 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pollinit();      // poll timeouts
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -54,6 +54,8 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   URING (p->ring, if the process has called ring_setup())
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define URING (TRAPFRAME - PGSIZE)
@@ -1,15 +1,19 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       64  // open files per process, at most 64
+#define NFILE      4096  // maximum open files per system
+#define NINODE      200  // initial size of the in-memory i-node table
+#define NDCACHE     256  // directory entries in the name cache
 #define NDEV         10  // maximum major device number
+#define PIPEPAGES    16  // max pages in a pipe's buffer (a power of 2)
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXIOV       16  // max buffers in one readv() or writev()
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      256  // max data blocks in on-disk log
+#define MAXWRITEBLOCKS (LOGSIZE/2)  // max # of blocks one write() transaction writes
+#define NBUF         (LOGSIZE*4)  // size of disk block cache
+#define FSSIZE       20000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
 
@@ -7,16 +7,26 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "waitq.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// A pipe's buffer starts as one page and doubles, up to
+// PIPEPAGES pages, when a writer has found it full and it
+// then drains: byte i of the stream is at offset i % size of
+// the buffer, and buf[] need not be contiguous, so bytes are
+// copied a run within one page at a time.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *buf[PIPEPAGES]; // npages pages of buffer
+  int npages;     // a power of 2
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int filled;     // a writer found the buffer full
+  struct waitq wq;  // polls waiting on either end
 };
 
 int
@@ -30,24 +40,36 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((pi->buf[0] = kalloc()) == 0){
+    kfree((char*)pi);
+    pi = 0;
+    goto bad;
+  }
+  pi->npages = 1;
+  pi->filled = 0;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
+  waitqinit(&pi->wq);
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = pi;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = pi;
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    kfree(pi->buf[0]);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -55,9 +77,34 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Double the size of pi's buffer, if it may grow and there
+// is memory. Called with the buffer empty, so that nothing
+// in it has to move.
+static void
+pipegrow(struct pipe *pi)
+{
+  int i, n;
+
+  pi->filled = 0;
+  n = pi->npages;
+  if(2 * n > PIPEPAGES)
+    return;
+  for(i = 0; i < n; i++){
+    if((pi->buf[n+i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(pi->buf[n+i]);
+      return;
+    }
+  }
+  pi->npages = 2 * n;
+  pi->nread = pi->nwrite = 0;
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
+  int i;
+
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
@@ -66,17 +113,48 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  waitqwake(&pi->wq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    for(i = 0; i < pi->npages; i++)
+      kfree(pi->buf[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Copy up to n bytes from src into pi's buffer, as far as it
+// has room, without sleeping. Caller holds pi->lock. Returns
+// the number of bytes copied, or -1 if none could be copied
+// from src.
+static int
+pipecopyin(struct pipe *pi, int user_src, uint64 src, int n)
+{
+  int i;
+  uint size, off, m;
+
+  size = pi->npages * PGSIZE;
+  if(pi->filled && pi->nwrite == pi->nread){
+    pipegrow(pi);
+    size = pi->npages * PGSIZE;
+  }
+  for(i = 0; i < n && pi->nwrite != pi->nread + size; i += m){
+    off = pi->nwrite % size;
+    m = min(n - i, size - (pi->nwrite - pi->nread));
+    m = min(m, PGSIZE - off % PGSIZE);
+    if(either_copyin(pi->buf[off / PGSIZE] + off % PGSIZE, user_src, src + i, m) == -1)
+      return i > 0 ? i : -1;
+    pi->nwrite += m;
+  }
+  return i;
+}
+
+// Copy n bytes from src into pi, waiting for room as needed,
+// or if nonblock, as many as there is room for; -1 if none.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 src, int n, int nonblock)
 {
-  int i = 0;
+  int i = 0, r;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,46 +163,130 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + pi->npages * PGSIZE){ //DOC: pipewrite-full
+      pi->filled = 1;
+      if(nonblock){
+        if(i == 0)
+          i = -1;
+        break;
+      }
       wakeup(&pi->nread);
+      waitqwake(&pi->wq);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      if((r = pipecopyin(pi, user_src, src + i, n - i)) < 0)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      i += r;
     }
   }
   wakeup(&pi->nread);
+  waitqwake(&pi->wq);
   release(&pi->lock);
 
   return i;
 }
 
+// Copy up to n bytes from kernel memory src into pi, as far
+// as it has room, without sleeping, so that the caller may
+// hold other locks. Returns the number of bytes copied, or -1
+// if the read end is closed.
+int
+pipeput(struct pipe *pi, char *src, int n)
+{
+  int r;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  if((r = pipecopyin(pi, 0, (uint64)src, n)) > 0){
+    wakeup(&pi->nread);
+    waitqwake(&pi->wq);
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// Wait until pi has room for pipeput() to copy into.
+// Returns -1 if the read end is closed or the caller is killed,
+// or if pi is full and nonblock is set.
+int
+pipewait(struct pipe *pi, int nonblock)
+{
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->readopen && !killed(pr) && pi->nwrite == pi->nread + pi->npages * PGSIZE){
+    pi->filled = 1;
+    if(nonblock){
+      release(&pi->lock);
+      return -1;
+    }
+    wakeup(&pi->nread);
+    waitqwake(&pi->wq);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || killed(pr)){
+    release(&pi->lock);
+    return -1;
+  }
+  release(&pi->lock);
+  return 0;
+}
+
+// Copy up to n bytes from pi to dst, waiting until there are
+// some, or returning -1 instead if nonblock.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 dst, int n, int nonblock)
 {
   int i;
+  uint size, off, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(killed(pr)){
+    if(killed(pr) || nonblock){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  size = pi->npages * PGSIZE;
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % size;
+    m = min(n - i, pi->nwrite - pi->nread);
+    m = min(m, PGSIZE - off % PGSIZE);
+    if(either_copyout(user_dst, dst + i, pi->buf[off / PGSIZE] + off % PGSIZE, m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0)
+    waitqwake(&pi->wq);
   release(&pi->lock);
   return i;
 }
+
+// Return POLLIN if pi has data, POLLHUP if it has no writer,
+// POLLOUT if it has room, and POLLERR if it has no reader,
+// putting e, if not 0, on pi's waitq first. See poll.c.
+int
+pipepoll(struct pipe *pi, struct pollentry *e)
+{
+  int r = 0;
+
+  if(e)
+    waitqadd(&pi->wq, e);
+  acquire(&pi->lock);
+  if(pi->nread != pi->nwrite)
+    r |= POLLIN;
+  if(!pi->writeopen)
+    r |= POLLHUP;
+  if(pi->nwrite != pi->nread + pi->npages * PGSIZE)
+    r |= POLLOUT;
+  if(!pi->readopen)
+    r |= POLLERR;
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,231 @@
+//
+// poll(): waiting for any of several files to become ready.
+//
+// A pipe or device that can be polled keeps a waitq of the
+// polls waiting on it, and calls waitqwake() whenever it may
+// have become ready, e.g. when data arrives or room appears.
+// A poll puts an entry on the waitq of each file it waits on
+// and only then checks the files, so a change that the check
+// misses finds the entry and wakes the poll. If no file is
+// ready the poll sleeps until a waitq wakes it or its timeout
+// passes, and checks them all again.
+//
+// Lock order: object's lock (pi->lock, cons.lock), waitq
+// lock, polltimers.lock, pollreq lock, p->lock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "poll.h"
+#include "waitq.h"
+
+struct pollentry {
+  struct pollreq *req;
+  struct waitq *wq;        // waitq the entry is on, or 0
+  struct pollentry *next;  // next on wq
+};
+
+// One poll() in progress. Fits in a page.
+struct pollreq {
+  struct spinlock lock;
+  int woken;               // a waitq or the timeout woke the poll
+  int expired;             // the timeout has passed
+  uint deadline;           // ticks, if on the timer list
+  struct pollreq *next;    // timer list
+  struct pollfd pfd[NOFILE];
+  struct file *f[NOFILE];  // references to the files polled
+  struct pollentry e[NOFILE];
+};
+
+// polls with a timeout, checked by polltick().
+struct {
+  struct spinlock lock;
+  struct pollreq *head;
+} polltimers;
+
+void
+pollinit(void)
+{
+  initlock(&polltimers.lock, "polltimers");
+}
+
+void
+waitqinit(struct waitq *wq)
+{
+  initlock(&wq->lock, "waitq");
+  wq->head = 0;
+}
+
+// Put e on wq, so that waitqwake(wq) wakes e's poll.
+void
+waitqadd(struct waitq *wq, struct pollentry *e)
+{
+  acquire(&wq->lock);
+  e->wq = wq;
+  e->next = wq->head;
+  wq->head = e;
+  release(&wq->lock);
+}
+
+static void
+waitqdel(struct pollentry *e)
+{
+  struct waitq *wq = e->wq;
+  struct pollentry **pp;
+
+  if(wq == 0)
+    return;
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  release(&wq->lock);
+  e->wq = 0;
+}
+
+static void
+pollwake(struct pollreq *req)
+{
+  acquire(&req->lock);
+  req->woken = 1;
+  wakeup(req);
+  release(&req->lock);
+}
+
+// Wake the polls on wq. The caller holds the lock protecting
+// the state the polls check, and has just changed it, so a
+// poll that put its entry on wq after this looks at head
+// will see the change.
+void
+waitqwake(struct waitq *wq)
+{
+  struct pollentry *e;
+
+  if(wq->head == 0)
+    return;
+  acquire(&wq->lock);
+  for(e = wq->head; e; e = e->next)
+    pollwake(e->req);
+  release(&wq->lock);
+}
+
+// Wake the polls whose timeout has passed.
+// Called by clockintr() on each tick.
+void
+polltick(uint now)
+{
+  struct pollreq *req;
+
+  if(polltimers.head == 0)
+    return;
+  acquire(&polltimers.lock);
+  for(req = polltimers.head; req; req = req->next){
+    if(!req->expired && (int)(now - req->deadline) >= 0){
+      req->expired = 1;
+      pollwake(req);
+    }
+  }
+  release(&polltimers.lock);
+}
+
+static void
+polltimerdel(struct pollreq *req)
+{
+  struct pollreq **pp;
+
+  acquire(&polltimers.lock);
+  for(pp = &polltimers.head; *pp; pp = &(*pp)->next){
+    if(*pp == req){
+      *pp = req->next;
+      break;
+    }
+  }
+  release(&polltimers.lock);
+}
+
+// Wait until one of the n files described by the pollfd array
+// at user address addr is ready, or timeout ticks pass; wait
+// forever if timeout is negative, not at all if it is 0. Fills
+// in revents, and returns the number of files with any, 0 if
+// the timeout passed, or -1.
+int
+poll(uint64 addr, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollreq *req;
+  struct pollfd *pfd;
+  int i, r, nready, wait, first;
+
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if((req = (struct pollreq*)kalloc()) == 0)
+    return -1;
+  if(copyin(p->pagetable, (char*)req->pfd, addr, n * sizeof(struct pollfd)) < 0){
+    kfree((char*)req);
+    return -1;
+  }
+  initlock(&req->lock, "poll");
+  req->woken = 0;
+  req->expired = 0;
+  for(i = 0; i < n; i++){
+    req->f[i] = req->pfd[i].fd >= 0 ? fdtget(p->fdt, req->pfd[i].fd) : 0;
+    req->e[i].req = req;
+    req->e[i].wq = 0;
+  }
+  if(timeout > 0){
+    acquire(&tickslock);
+    req->deadline = ticks + timeout;
+    release(&tickslock);
+    acquire(&polltimers.lock);
+    req->next = polltimers.head;
+    polltimers.head = req;
+    release(&polltimers.lock);
+  }
+
+  wait = timeout != 0;
+  for(first = 1; ; first = 0){
+    nready = 0;
+    for(i = 0; i < n; i++){
+      pfd = &req->pfd[i];
+      if(pfd->fd < 0)
+        r = 0;
+      else if(req->f[i] == 0)
+        r = POLLNVAL;
+      else
+        r = filepoll(req->f[i], wait && first ? &req->e[i] : 0) &
+            (pfd->events | POLLERR | POLLHUP);
+      pfd->revents = r;
+      if(r)
+        nready++;
+    }
+    acquire(&req->lock);
+    if(nready > 0 || !wait || req->expired || killed(p)){
+      release(&req->lock);
+      break;
+    }
+    while(!req->woken && !killed(p))
+      sleep(req, &req->lock);
+    req->woken = 0;
+    release(&req->lock);
+  }
+
+  for(i = 0; i < n; i++){
+    waitqdel(&req->e[i]);
+    if(req->f[i])
+      fileclose(req->f[i]);
+  }
+  if(timeout > 0)
+    polltimerdel(req);
+  if(killed(p) ||
+     copyout(p->pagetable, addr, (char*)req->pfd, n * sizeof(struct pollfd)) < 0)
+    nready = -1;
+  kfree((char*)req);
+  return nready;
+}
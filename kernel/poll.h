@@ -0,0 +1,12 @@
+// One file descriptor of a poll().
+struct pollfd {
+  int fd;         // File descriptor, ignored if negative
+  short events;   // Events to wait for
+  short revents;  // Events that have happened
+};
+
+#define POLLIN   0x001  // a read will not block
+#define POLLOUT  0x004  // a write will not block
+#define POLLERR  0x008  // pipe has no reader; always reported
+#define POLLHUP  0x010  // pipe has no writer; always reported
+#define POLLNVAL 0x020  // fd is not open; always reported
@@ -14,19 +14,54 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "klog.h"
 
 volatile int panicked = 0;
+volatile int panicking = 0;
+
+// printf() formats into a buffer of the CPU's own, with
+// interrupts off, and hands it to the uart, which sends it
+// from its interrupt, when it fills and at the end. So
+// printf() doesn't wait for the uart, and output from
+// different CPUs doesn't interleave within one printf()
+// of up to PRBUFSIZE characters. Once the kernel panics,
+// printf() sends each character synchronously.
+#define PRBUFSIZE 128
 
-// lock to avoid interleaving concurrent printf's.
 static struct {
-  struct spinlock lock;
-  int locking;
-} pr;
+  char buf[PRBUFSIZE];
+  int n;
+} prbuf[NCPU];
+
+static void
+prflush(void)
+{
+  int id = cpuid();
+
+  if(prbuf[id].n > 0){
+    uartputs(prbuf[id].buf, prbuf[id].n);
+    prbuf[id].n = 0;
+  }
+}
+
+static void
+prputc(int c, void *arg)
+{
+  int id = cpuid();
+
+  if(panicking){
+    consputc(c);
+    return;
+  }
+  prbuf[id].buf[prbuf[id].n++] = c;
+  if(prbuf[id].n == PRBUFSIZE)
+    prflush();
+}
 
 static char digits[] = "0123456789abcdef";
 
 static void
-printint(long long xx, int base, int sign)
+printint(void (*put)(int, void*), void *arg, long long xx, int base, int sign)
 {
   char buf[16];
   int i;
@@ -46,35 +81,30 @@ printint(long long xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    put(buf[i], arg);
 }
 
 static void
-printptr(uint64 x)
+printptr(void (*put)(int, void*), void *arg, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  put('0', arg);
+  put('x', arg);
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    put(digits[x >> (sizeof(uint64) * 8 - 4)], arg);
 }
 
-// Print to the console.
-int
-printf(char *fmt, ...)
+// Format fmt and ap, handing each character to put(c, arg),
+// so that printf() and klog() share the formatting.
+static void
+vprintf(void (*put)(int, void*), void *arg, char *fmt, va_list ap)
 {
-  va_list ap;
-  int i, cx, c0, c1, c2, locking;
+  int i, cx, c0, c1, c2;
   char *s;
 
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-
-  va_start(ap, fmt);
   for(i = 0; (cx = fmt[i] & 0xff) != 0; i++){
     if(cx != '%'){
-      consputc(cx);
+      put(cx, arg);
       continue;
     }
     i++;
@@ -83,96 +113,134 @@ printf(char *fmt, ...)
     if(c0) c1 = fmt[i+1] & 0xff;
     if(c1) c2 = fmt[i+2] & 0xff;
     if(c0 == 'd'){
-      printint(va_arg(ap, int), 10, 1);
+      printint(put, arg, va_arg(ap, int), 10, 1);
     } else if(c0 == 'l' && c1 == 'd'){
-      printint(va_arg(ap, uint64), 10, 1);
+      printint(put, arg, va_arg(ap, uint64), 10, 1);
       i += 1;
     } else if(c0 == 'l' && c1 == 'l' && c2 == 'd'){
-      printint(va_arg(ap, uint64), 10, 1);
+      printint(put, arg, va_arg(ap, uint64), 10, 1);
       i += 2;
     } else if(c0 == 'u'){
-      printint(va_arg(ap, int), 10, 0);
+      printint(put, arg, va_arg(ap, int), 10, 0);
     } else if(c0 == 'l' && c1 == 'u'){
-      printint(va_arg(ap, uint64), 10, 0);
+      printint(put, arg, va_arg(ap, uint64), 10, 0);
       i += 1;
     } else if(c0 == 'l' && c1 == 'l' && c2 == 'u'){
-      printint(va_arg(ap, uint64), 10, 0);
+      printint(put, arg, va_arg(ap, uint64), 10, 0);
       i += 2;
     } else if(c0 == 'x'){
-      printint(va_arg(ap, int), 16, 0);
+      printint(put, arg, va_arg(ap, int), 16, 0);
     } else if(c0 == 'l' && c1 == 'x'){
-      printint(va_arg(ap, uint64), 16, 0);
+      printint(put, arg, va_arg(ap, uint64), 16, 0);
       i += 1;
     } else if(c0 == 'l' && c1 == 'l' && c2 == 'x'){
-      printint(va_arg(ap, uint64), 16, 0);
+      printint(put, arg, va_arg(ap, uint64), 16, 0);
       i += 2;
     } else if(c0 == 'p'){
-      printptr(va_arg(ap, uint64));
+      printptr(put, arg, va_arg(ap, uint64));
     } else if(c0 == 's'){
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        put(*s, arg);
     } else if(c0 == '%'){
-      consputc('%');
+      put('%', arg);
     } else if(c0 == 0){
       break;
     } else {
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c0);
+      put('%', arg);
+      put(c0, arg);
     }
 
 #if 0
     switch(c){
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      printint(put, arg, va_arg(ap, int), 10, 1);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      printint(put, arg, va_arg(ap, int), 16, 1);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      printptr(put, arg, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        put(*s, arg);
       break;
     case '%':
-      consputc('%');
+      put('%', arg);
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      put('%', arg);
+      put(c, arg);
       break;
     }
 #endif
   }
-  va_end(ap);
+}
 
-  if(locking)
-    release(&pr.lock);
+// Print to the console.
+int
+printf(char *fmt, ...)
+{
+  va_list ap;
+
+  push_off();
+  va_start(ap, fmt);
+  vprintf(prputc, 0, fmt, ap);
+  va_end(ap);
+  if(!panicking)
+    prflush();
+  pop_off();
 
   return 0;
 }
 
+struct sbuf {
+  char *buf;
+  int n;
+  int size;
+};
+
+static void
+sputc(int c, void *arg)
+{
+  struct sbuf *s = arg;
+
+  if(s->n < s->size - 1)
+    s->buf[s->n++] = c;
+}
+
+// Add a record to the kernel log, for reading with
+// klog_read(), without printing anything or taking any
+// locks. Messages longer than KLOGMSG-1 are cut short.
+void
+klog(char *fmt, ...)
+{
+  va_list ap;
+  char buf[KLOGMSG];
+  struct sbuf s = { buf, 0, sizeof(buf) };
+
+  va_start(ap, fmt);
+  vprintf(sputc, &s, fmt, ap);
+  va_end(ap);
+  buf[s.n] = 0;
+  klogwrite(buf, s.n);
+}
+
+
 void
 panic(char *s)
 {
-  pr.locking = 0;
+  panicking = 1;
+  uartflush();  // what other printf()s queued comes first
   printf("panic: ");
   printf("%s\n", s);
   panicked = 1; // freeze uart output from other CPUs
   for(;;)
     ;
 }
-
-void
-printfinit(void)
-{
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;
-}
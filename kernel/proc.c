@@ -201,6 +201,7 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->ring = 0;
   p->sz = 0;
 
   p->pid = 0;
@@ -249,12 +250,14 @@ proc_pagetable(struct proc *p)
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to, including its ring.
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  if(walkaddr(pagetable, URING))
+    uvmunmap(pagetable, URING, 1, 1);
   uvmfree(pagetable, sz);
 }
 
@@ -290,7 +293,8 @@ userinit(void)
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->fdt = fdtalloc(namei("/"))) == 0)
+    panic("userinit");
 
   p->state = RUNNABLE;
 
@@ -332,8 +336,6 @@ growproc(int n)
 //clone: 
 int
 clone(void (*fcn)(void*, void*), void *arg1, void *arg2, void *stack){
-  int i;
-
   // 1.) allocate a new process struct proc 
   struct proc *np;
   struct proc *p = myproc();
@@ -365,12 +367,8 @@ clone(void (*fcn)(void*, void*), void *arg1, void *arg2, void *stack){
   np->trapframe->a1 = (uint64)arg2;
 
 
-  // 4.) copy file descriptor 
-  for (i = 0; i < NOFILE; i++)
-    if (p->ofile[i]){
-      np->ofile[i] = filedup(p->ofile[i]); //filedup: duplicated file descriptor 
-    }
-  np->cwd = idup(p->cwd); 
+  // 4.) share file descriptor table and current directory
+  np->fdt = fdtdup(p->fdt);
 
   // Set state to RUNNABLE
   np->state = RUNNABLE;
@@ -452,7 +450,7 @@ int join (void **stack){
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
@@ -476,10 +474,11 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  if((np->fdt = fdtcopy(p->fdt)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -524,19 +523,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
-
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+  // Close all open files, unless other threads still use them.
+  fdtput(p->fdt);
+  p->fdt = 0;
 
   acquire(&wait_lock);
 
@@ -79,6 +79,16 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// Open files and current directory of a process, shared by
+// the threads it clone()s. lock protects ofile, used and cwd.
+struct fdtable {
+  struct spinlock lock;
+  int ref;                    // # of processes using it, changed atomically
+  uint64 used;                // bit fd is set if ofile[fd] != 0
+  struct file *ofile[NOFILE];
+  struct inode *cwd;
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -100,9 +110,11 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct ring *ring;           // page mapped at URING, or 0
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct fdtable *fdt;         // Open files and current directory
+  struct file *held[2];        // Files fdget() holds, see sysfile.c
+  int nheld;
   char name[16];               // Process name (debugging)
 
   // MLFQ: 
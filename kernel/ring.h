@@ -0,0 +1,41 @@
+// Submission and completion ring that a process shares with
+// the kernel, set up by ring_setup(), so that it can make many
+// read, write, open and close calls with one ring_enter().
+//
+// The process fills in sq[sqtail % RINGSIZE] and then
+// advances sqtail. ring_enter() runs submissions from sqhead
+// on, advancing sqhead, and posts a completion for each in
+// cq[cqtail % RINGSIZE], as long as cq has room, that is,
+// cqtail - cqhead < RINGSIZE; the process reads completions
+// and then advances cqhead.
+
+#define RINGSIZE 64  // entries in sq and in cq
+
+#define RING_READ  1  // read(fd, addr, n)
+#define RING_WRITE 2  // write(fd, addr, n)
+#define RING_OPEN  3  // open(addr, n)
+#define RING_CLOSE 4  // close(fd)
+
+struct ringsqe {
+  int op;       // RING_xxx
+  int fd;
+  int n;
+  int pad;
+  uint64 addr;
+  uint64 data;  // passed back in the completion
+};
+
+struct ringcqe {
+  uint64 data;  // from the submission
+  int res;      // what the call returned
+  int pad;
+};
+
+struct ring {
+  uint sqhead;  // written by the kernel
+  uint sqtail;  // written by the process
+  uint cqhead;  // written by the process
+  uint cqtail;  // written by the kernel
+  struct ringsqe sq[RINGSIZE];
+  struct ringcqe cq[RINGSIZE];
+};
@@ -15,6 +15,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->waiting = 0;
   lk->pid = 0;
 }
 
@@ -22,9 +24,11 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->waiting++;
+  while (lk->locked || lk->readers > 0) {
     sleep(lk, &lk->lk);
   }
+  lk->waiting--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
@@ -40,6 +44,31 @@ releasesleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers. New readers wait
+// while a writer is waiting, so that writers are not starved;
+// so a process must not acquire a lock shared twice.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->waiting > 0) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
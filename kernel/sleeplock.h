@@ -1,6 +1,10 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either exclusively by one process (acquiresleep) or
+// shared by any number of readers (acquiresleepshared).
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // # of processes holding it shared
+  int waiting;       // # of processes waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
@@ -104,6 +104,16 @@ extern uint64 sys_close(void);
 extern uint64 sys_getppid(void);
 extern uint64 sys_clone(void); 
 extern uint64 sys_join(void); 
+extern uint64 sys_splice(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_ring_setup(void);
+extern uint64 sys_ring_enter(void);
+extern uint64 sys_klog_read(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_fcntl(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -137,6 +147,16 @@ static uint64 (*syscalls[])(void) = {
 [SYS_yield] sys_yield,
 [SYS_clone] sys_clone,
 [SYS_join] sys_join,
+[SYS_splice] sys_splice,
+[SYS_readv] sys_readv,
+[SYS_writev] sys_writev,
+[SYS_pread] sys_pread,
+[SYS_pwrite] sys_pwrite,
+[SYS_ring_setup] sys_ring_setup,
+[SYS_ring_enter] sys_ring_enter,
+[SYS_klog_read] sys_klog_read,
+[SYS_poll] sys_poll,
+[SYS_fcntl] sys_fcntl,
 };
 
 void
@@ -150,6 +170,8 @@ syscall(void)
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
     p->trapframe->a0 = syscalls[num]();
+    if(p->nheld > 0)
+      fdrelease();
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
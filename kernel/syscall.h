@@ -28,4 +28,14 @@
 #define SYS_yield 27 
 #define SYS_clone 28 
 #define SYS_join 29 
+#define SYS_splice 30
+#define SYS_readv  31
+#define SYS_writev 32
+#define SYS_pread  33
+#define SYS_pwrite 34
+#define SYS_ring_setup 35
+#define SYS_ring_enter 36
+#define SYS_klog_read 37
+#define SYS_poll   38
+#define SYS_fcntl  39
 
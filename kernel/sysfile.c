@@ -15,6 +15,43 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "ring.h"
+#include "memlayout.h"
+
+// Return the open file for descriptor fd, or 0.
+// If other threads share the descriptor table, one of them
+// could close fd and free the file while this system call
+// uses it, so take a reference, which fdrelease() drops
+// when the system call returns.
+static struct file*
+fdget(int fd)
+{
+  struct proc *p = myproc();
+  struct fdtable *t = p->fdt;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  if(__atomic_load_n(&t->ref, __ATOMIC_ACQUIRE) == 1)
+    return t->ofile[fd];
+  if((f = fdtget(t, fd)) != 0){
+    if(p->nheld >= NELEM(p->held))
+      panic("fdget");
+    p->held[p->nheld++] = f;
+  }
+  return f;
+}
+
+// Drop the references fdget() took.
+void
+fdrelease(void)
+{
+  struct proc *p = myproc();
+
+  while(p->nheld > 0)
+    fileclose(p->held[--p->nheld]);
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -25,7 +62,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -39,16 +76,60 @@ argfd(int n, int *pfd, struct file **pf)
 static int
 fdalloc(struct file *f)
 {
+  struct fdtable *t = myproc()->fdt;
   int fd;
-  struct proc *p = myproc();
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
+  acquire(&t->lock);
+  if(~t->used == 0 || (fd = ffz(t->used)) >= NOFILE){
+    release(&t->lock);
+    return -1;
+  }
+  t->used |= 1UL << fd;
+  t->ofile[fd] = f;
+  release(&t->lock);
+  return fd;
+}
+
+// Remove descriptor fd and return its file, whose
+// reference passes to the caller, or return 0.
+static struct file*
+fdremove(int fd)
+{
+  struct fdtable *t = myproc()->fdt;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&t->lock);
+  if((f = t->ofile[fd]) != 0){
+    t->ofile[fd] = 0;
+    t->used &= ~(1UL << fd);
+  }
+  release(&t->lock);
+  return f;
+}
+
+// Undo fd = fdalloc(f): remove fd and drop the table's
+// reference to f, unless another thread has closed fd since.
+// If fd is -1, f never got a descriptor, so just drop the
+// reference. The caller holds a reference of its own, so f
+// cannot have been freed and reopened as fd meanwhile.
+static void
+fdunalloc(int fd, struct file *f)
+{
+  struct fdtable *t = myproc()->fdt;
+
+  if(fd >= 0){
+    acquire(&t->lock);
+    if(t->ofile[fd] != f){
+      release(&t->lock);
+      return;
     }
+    t->ofile[fd] = 0;
+    t->used &= ~(1UL << fd);
+    release(&t->lock);
   }
-  return -1;
+  fileclose(f);
 }
 
 uint64
@@ -59,9 +140,13 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
-    return -1;
+  // take the reference before f is in the table, where a
+  // thread sharing it could close fd at once.
   filedup(f);
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -94,15 +179,108 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the nth and next system call arguments as a user
+// array of iovecs and their number, and copy the array into
+// iov. The buffers must add up to less than 2GB.
+static int
+argiov(int n, struct iovec *iov, int *pniov)
+{
+  uint64 uiov, tot;
+  int i, niov;
+
+  argaddr(n, &uiov);
+  argint(n+1, &niov);
+  if(niov < 0 || niov > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, niov*sizeof(*iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < niov; i++){
+    if(iov[i].len >= 0x80000000)
+      return -1;
+    tot += iov[i].len;
+  }
+  if(tot >= 0x80000000)
+    return -1;
+  *pniov = niov;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &niov) < 0)
+    return -1;
+  return filereadv(f, iov, niov);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &niov) < 0)
+    return -1;
+  return filewritev(f, iov, niov);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 uint64
 sys_close(void)
 {
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  argint(0, &fd);
+  if((f = fdremove(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -169,22 +347,6 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
@@ -222,6 +384,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_unlink(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -274,8 +437,10 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
+    // A new directory is hashed like its parent.
     // No ip->nlink++ for ".": avoid cyclic ref count.
-    if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
+    if(dirinit(ip, dp->major > 0) < 0 ||
+       dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
       goto fail;
   }
 
@@ -301,18 +466,14 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path in mode omode, as for open(); returns the
+// new file descriptor, or -1.
+static int
+openpath(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -328,7 +489,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & ~O_NONBLOCK) != O_RDONLY){
       iunlockput(ip);
       end_op();
       return -1;
@@ -341,9 +502,7 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -359,6 +518,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -367,22 +527,38 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  // only now that f is filled in may another thread see it.
+  if((fd = fdalloc(f)) < 0)
+    fileclose(f);
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  // room for the first two blocks of a hashed directory.
+  begin_opn(MAXOPBLOCKS + 3);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op();
+    end_opn(MAXOPBLOCKS + 3);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_opn(MAXOPBLOCKS + 3);
   return 0;
 }
 
@@ -410,8 +586,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct fdtable *t = myproc()->fdt;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,9 +601,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&t->lock);
+  old = t->cwd;
+  t->cwd = ip;
+  release(&t->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
@@ -479,27 +658,155 @@ sys_pipe(void)
 {
   uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
-  int fd0, fd1;
+  int fd0, fd1, r;
   struct proc *p = myproc();
 
   argaddr(0, &fdarray);
   if(pipealloc(&rf, &wf) < 0)
     return -1;
-  fd0 = -1;
-  if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
-    fileclose(wf);
+  // the descriptors take over pipealloc()'s references, but a
+  // thread sharing the table may close them at once, so hold
+  // references of our own until done with rf and wf.
+  filedup(rf);
+  filedup(wf);
+  r = 0;
+  fd0 = fd1 = -1;
+  if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0 ||
+     copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
+     copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
+    fdunalloc(fd0, rf);
+    fdunalloc(fd1, wf);
+    r = -1;
+  }
+  fileclose(rf);
+  fileclose(wf);
+  return r;
+}
+
+// Map a ring page into the process at URING, if it does not
+// have one yet, and return its address.
+uint64
+sys_ring_setup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  if(p->ring == 0){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(mappages(p->pagetable, URING, PGSIZE, (uint64)mem, PTE_R | PTE_W | PTE_U) < 0){
+      kfree(mem);
+      return -1;
+    }
+    p->ring = (struct ring*)mem;
+  }
+  return URING;
+}
+
+// Carry out one ring submission; returns what the
+// corresponding system call would.
+static int
+ringop(struct ringsqe *e)
+{
+  char path[MAXPATH];
+  struct file *f;
+
+  switch(e->op){
+  case RING_READ:
+    if((f = fdget(e->fd)) == 0)
+      return -1;
+    return fileread(f, e->addr, e->n);
+  case RING_WRITE:
+    if((f = fdget(e->fd)) == 0)
+      return -1;
+    return filewrite(f, e->addr, e->n);
+  case RING_OPEN:
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return openpath(path, e->n);
+  case RING_CLOSE:
+    if((f = fdremove(e->fd)) == 0)
+      return -1;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// Run up to n of the process's ring submissions, in order,
+// or all of them if n is 0, posting a completion for each.
+// Stops early if the completion queue is full. Returns the
+// number of submissions run.
+uint64
+sys_ring_enter(void)
+{
+  struct proc *p = myproc();
+  struct ring *r = p->ring;
+  struct ringsqe e;
+  struct ringcqe *c;
+  uint head, tail;
+  int n, done, res;
+
+  argint(0, &n);
+  if(r == 0 || n < 0)
+    return -1;
+  head = r->sqhead;
+  tail = r->sqtail;
+  __sync_synchronize();
+  if(tail - head > RINGSIZE)
     return -1;
+
+  for(done = 0; head != tail && (n == 0 || done < n); done++){
+    if(r->cqtail - r->cqhead >= RINGSIZE || killed(p))
+      break;
+    e = r->sq[head % RINGSIZE];  // copy, since the process may change it
+    res = ringop(&e);
+    fdrelease();
+    c = &r->cq[r->cqtail % RINGSIZE];
+    c->data = e.data;
+    c->res = res;
+    __sync_synchronize();
+    r->cqtail++;
+    r->sqhead = ++head;
   }
-  if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
-     copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+  return done;
+}
+
+// Wait for one of several descriptors to become ready.
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int n, timeout;
+
+  argaddr(0, &fds);
+  argint(1, &n);
+  argint(2, &timeout);
+  return poll(fds, n, timeout);
+}
+
+// Get or set the O_ flags of an open file. Only
+// O_NONBLOCK can be set.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg, flags;
+
+  argint(1, &cmd);
+  argint(2, &arg);
+  if(argfd(0, 0, &f) < 0)
     return -1;
+  switch(cmd){
+  case F_GETFL:
+    flags = f->readable && f->writable ? O_RDWR : f->writable ? O_WRONLY : O_RDONLY;
+    if(f->nonblock)
+      flags |= O_NONBLOCK;
+    return flags;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
   }
-  return 0;
+  return -1;
 }
@@ -102,6 +102,21 @@ sys_uptime(void)
   return xticks;
 }
 
+// remove up to n records from the kernel log
+// and copy them to the user array of struct klogrec.
+uint64
+sys_klog_read(void)
+{
+  uint64 p;
+  int n;
+
+  argaddr(0, &p);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  return klogread(p, n);
+}
+
 uint64
 sys_getlev(void){
   if (scheduling_mode == 0 ) { // FCFS -> 99. 
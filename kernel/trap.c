@@ -199,6 +199,7 @@ clockintr()
     ticks++;
     wakeup(&ticks);
     release(&tickslock);
+    polltick(ticks);
   }
 
   // ask for the next timer interrupt. this also clears
@@ -40,12 +40,13 @@
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 1024
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
 
 extern volatile int panicked; // from printf.c
+extern volatile int panicking; // from printf.c
 
 void uartstart();
 
@@ -77,35 +78,87 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
+// add n characters to the output buffer and tell the
 // UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *buf, int n)
 {
+  int i;
+
   acquire(&uart_tx_lock);
+  for(i = 0; i < n; i++){
+    if(panicked){
+      for(;;)
+        ;
+    }
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // wait for uartintr() to open up space in the buffer.
+      uartstart();
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = buf[i];
+    uart_tx_w += 1;
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
 
-  if(panicked){
-    for(;;)
-      ;
+// add n characters to the output buffer, for kernel
+// printf(). never sleeps, so that it can be called
+// with any locks held and from interrupts: if the
+// buffer is full, spins sending characters to make room.
+// a panic, or a print by this CPU while it holds
+// uart_tx_lock, would wait for the lock forever, so
+// those send synchronously instead.
+void
+uartputs(char *buf, int n)
+{
+  int i;
+
+  if(panicking || holding(&uart_tx_lock)){
+    for(i = 0; i < n; i++)
+      uartputc_sync(buf[i]);
+    return;
   }
-  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
-    // buffer is full.
-    // wait for uartstart() to open up space in the buffer.
-    sleep(&uart_tx_r, &uart_tx_lock);
+
+  acquire(&uart_tx_lock);
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      if(panicked){
+        for(;;)
+          ;
+      }
+      uartstart();
+    }
+    uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = buf[i];
+    uart_tx_w += 1;
   }
-  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
-  uart_tx_w += 1;
   uartstart();
   release(&uart_tx_lock);
 }
 
+// send whatever is in the output buffer, spinning,
+// for panic(). doesn't take uart_tx_lock, since the
+// panicking CPU may hold it.
+void
+uartflush(void)
+{
+  while(uart_tx_r != uart_tx_w){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
+    uart_tx_r += 1;
+  }
+}
+
 
-// alternate version of uartputc() that doesn't 
-// use interrupts, for use by kernel printf() and
+// alternate version of uartwrite() for one character
+// that doesn't use interrupts, for use by panic() and
 // to echo characters. it spins waiting for the uart's
 // output register to be empty.
 void
@@ -126,10 +179,13 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, send them.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
+// doesn't wake up writers waiting for space, since
+// uartputs() may call it with any lock held;
+// uartintr() does.
 void
 uartstart()
 {
@@ -150,9 +206,6 @@ uartstart()
     int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
     uart_tx_r += 1;
     
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
     WriteReg(THR, c);
   }
 }
@@ -187,5 +240,7 @@ uartintr(void)
   // send buffered characters.
   acquire(&uart_tx_lock);
   uartstart();
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
   release(&uart_tx_lock);
 }
@@ -0,0 +1,5 @@
+// One buffer of a readv() or writev().
+struct iovec {
+  void *base;  // Start of buffer
+  uint64 len;  // Size of buffer in bytes
+};
@@ -47,7 +47,8 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// a request for n blocks uses n+2 of them.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
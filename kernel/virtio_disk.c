@@ -196,12 +196,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +211,32 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// read or write n buffers from or to n consecutive disk
+// blocks starting at blockno, in a single request.
+// bs[0] stands for the whole request in disk.info[].
+static void
+disk_rw(struct buf **bs, int n, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = blockno * (BSIZE / 512);
+  struct buf *b = bs[0];
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. a request may carry
+  // several data descriptors, for consecutive sectors.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[NUM];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,20 +253,22 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) bs[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
@@ -291,6 +297,28 @@ virtio_disk_rw(struct buf *b, int write)
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  disk_rw(&b, 1, b->blockno, write);
+}
+
+// write the data of n buffers to n consecutive disk blocks
+// starting at blockno, which need not be the buffers' own
+// block numbers. uses as few requests as the descriptor
+// ring allows, leaving room for other requests.
+void
+virtio_disk_writev(struct buf **bs, int n, uint blockno)
+{
+  while(n > 0){
+    int m = n < NUM/2 - 2 ? n : NUM/2 - 2;
+    disk_rw(bs, m, blockno, 1);
+    bs += m;
+    n -= m;
+    blockno += m;
+  }
+}
+
 void
 virtio_disk_intr()
 {
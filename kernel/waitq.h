@@ -0,0 +1,6 @@
+// The polls waiting for a pipe or device to become ready.
+// See poll.c.
+struct waitq {
+  struct spinlock lock;
+  struct pollentry *head;
+};
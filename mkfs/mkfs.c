@@ -21,8 +21,9 @@
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/BPB + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int ninodes = NINODES;
+int ninodeblocks;
+int nlog = LOGBLOCKS;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +32,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int hashed;    // make the root directory hashed
 
 
 void balloc(int);
@@ -40,6 +42,9 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint inum, struct dirent *de);
+void dirhashed(uint inum, int argc, char *argv[]);
+char *fsname(char *path);
 void die(const char *);
 
 // convert to riscv byte order
@@ -77,10 +82,20 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-h") == 0)
+      hashed = 1;
+    else if(strcmp(argv[1], "-i") == 0 && argc > 2){
+      ninodes = atoi(argv[2]);
+      argc--, argv++;
+    } else
+      break;
+  }
+  if(argc < 2 || argv[1][0] == '-' || ninodes < 2 || ninodes > MAXINODES){
+    fprintf(stderr, "Usage: mkfs [-h] [-i ninodes] fs.img files...\n");
     exit(1);
   }
+  ninodeblocks = ninodes / IPB + 1;
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
@@ -96,7 +111,7 @@ main(int argc, char *argv[])
   sb.magic = FSMAGIC;
   sb.size = xint(FSSIZE);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
@@ -117,44 +132,32 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
+  if(hashed)
+    dirhashed(rootino, argc - 2, argv + 2);
+
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  dirappend(rootino, &de);
 
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirappend(rootino, &de);
 
   for(i = 2; i < argc; i++){
-    // get rid of "user/"
-    char *shortname;
-    if(strncmp(argv[i], "user/", 5) == 0)
-      shortname = argv[i] + 5;
-    else
-      shortname = argv[i];
-    
-    assert(index(shortname, '/') == 0);
+    char *shortname = fsname(argv[i]);
 
     if((fd = open(argv[i], 0)) < 0)
       die(argv[i]);
 
-    // Skip leading _ in name when writing to file system.
-    // The binaries are named _rm, _cat, etc. to keep the
-    // build operating system from trying to execute them
-    // in place of system binaries like rm and cat.
-    if(shortname[0] == '_')
-      shortname += 1;
 
-    assert(strlen(shortname) <= DIRSIZ);
-    
     inum = ialloc(T_FILE);
 
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, &de);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -164,10 +167,12 @@ main(int argc, char *argv[])
 
   // fix size of root inode dir
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(!hashed){
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -225,6 +230,7 @@ ialloc(ushort type)
   uint inum = freeinode++;
   struct dinode din;
 
+  assert(inum < ninodes);
   bzero(&din, sizeof(din));
   din.type = xshort(type);
   din.nlink = xshort(1);
@@ -259,7 +265,7 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind, idx;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -272,7 +278,7 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -282,6 +288,24 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      idx = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
+      if(indirect[idx] == 0){
+        indirect[idx] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      ind = xint(indirect[idx]);
+      rsect(ind, (char*)indirect);
+      idx = (fbn - NDIRECT - NINDIRECT) % NINDIRECT;
+      if(indirect[idx] == 0){
+        indirect[idx] = xint(freeblock++);
+        wsect(ind, (char*)indirect);
+      }
+      x = xint(indirect[idx]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,6 +319,139 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// The name in the file system of the file at path.
+char*
+fsname(char *path)
+{
+  char *shortname;
+
+  // get rid of "user/"
+  if(strncmp(path, "user/", 5) == 0)
+    shortname = path + 5;
+  else
+    shortname = path;
+
+  assert(index(shortname, '/') == 0);
+
+  // Skip leading _ in name when writing to file system.
+  // The binaries are named _rm, _cat, etc. to keep the
+  // build operating system from trying to execute them
+  // in place of system binaries like rm and cat.
+  if(shortname[0] == '_')
+    shortname += 1;
+
+  assert(strlen(shortname) <= DIRSIZ);
+  return shortname;
+}
+
+// The kernel's dirhash().
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Disk address of block fbn of inode inum, which has one.
+uint
+fsect(uint inum, uint fbn)
+{
+  struct dinode din;
+  uint indirect[NINDIRECT];
+
+  rinode(inum, &din);
+  assert(fbn < NDIRECT + NINDIRECT);
+  if(fbn < NDIRECT)
+    return xint(din.addrs[fbn]);
+  rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+  return xint(indirect[fbn - NDIRECT]);
+}
+
+// Entry k of the hashed directory table in block buf.
+ushort*
+dirtab(char *buf, uint k)
+{
+  return (ushort*)((struct dirent*)buf + 1 + k / DIRTABPER)->name + k % DIRTABPER;
+}
+
+// Make the empty directory inum hashed, with enough buckets that
+// ".", "..", and the n files at paths fit without the kernel's
+// splitting or chaining: 2^depth buckets, each of that depth.
+void
+dirhashed(uint inum, int n, char *paths[])
+{
+  struct dinode din;
+  char buf[BSIZE];
+  uint depth, k, nb;
+  int i, full;
+  static int count[1 << MAXDIRDEPTH];
+
+  for(depth = 0; ; depth++){
+    if(depth > MAXDIRDEPTH)
+      die("dirhashed: too many files");
+    nb = 1 << depth;
+    memset(count, 0, sizeof(count));
+    count[dirhash(".") % nb]++;
+    count[dirhash("..") % nb]++;
+    for(i = 0; i < n; i++)
+      count[dirhash(fsname(paths[i])) % nb]++;
+    full = 0;
+    for(k = 0; k < nb; k++)
+      if(count[k] > BSIZE / sizeof(struct dirent) - 1)
+        full = 1;
+    if(!full)
+      break;
+  }
+
+  rinode(inum, &din);
+  din.major = xshort(1);
+  winode(inum, &din);
+
+  bzero(buf, BSIZE);
+  ((struct dirhdr*)buf)->depth = xshort(depth);
+  for(k = 0; k < nb; k++)
+    *dirtab(buf, k) = xshort(1 + k);
+  iappend(inum, buf, BSIZE);
+  bzero(buf, BSIZE);
+  ((struct dirhdr*)buf)->depth = xshort(depth);
+  for(k = 0; k < nb; k++)
+    iappend(inum, buf, BSIZE);
+}
+
+// Add de to directory inum, which is linear or, like the
+// kernel's dirlink(), hashed.
+void
+dirappend(uint inum, struct dirent *de)
+{
+  struct dinode din;
+  struct dirent des[BSIZE / sizeof(struct dirent)];
+  uint x;
+  int j;
+
+  rinode(inum, &din);
+  if(xshort(din.major) == 0){
+    iappend(inum, de, sizeof(*de));
+    return;
+  }
+
+  rsect(fsect(inum, 0), (char*)des);
+  j = xshort(((struct dirhdr*)des)->depth);
+  x = fsect(inum, xshort(*dirtab((char*)des, dirhash(de->name) % (1 << j))));
+  rsect(x, (char*)des);
+  for(j = 1; j < BSIZE / sizeof(struct dirent); j++){
+    if(des[j].inum == 0){
+      des[j] = *de;
+      wsect(x, (char*)des);
+      return;
+    }
+  }
+  die("dirappend: directory full");
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,65 @@
+// Sequential write throughput for one large file.
+// Writes the file in large write() calls, so the kernel
+// is free to batch many blocks into each log transaction,
+// and reports blocks per second.
+//
+//   bigwrite [nblocks [chunkblocks]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define CHUNK 32
+#define NBLOCKS 4096
+
+char buf[CHUNK*BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, m, nblocks, chunk, t0, t1;
+
+  nblocks = NBLOCKS;
+  chunk = CHUNK;
+  if(argc > 1)
+    nblocks = atoi(argv[1]);
+  if(argc > 2)
+    chunk = atoi(argv[2]);
+  if(nblocks < 1 || nblocks > MAXFILE || chunk < 1 || chunk > CHUNK){
+    fprintf(2, "usage: bigwrite [nblocks(1-%d) [chunkblocks(1-%d)]]\n",
+            (int)MAXFILE, CHUNK);
+    exit(1);
+  }
+
+  memset(buf, 'b', sizeof(buf));
+  unlink("bigwrite.tmp");
+  fd = open("bigwrite.tmp", O_CREATE | O_RDWR);
+  if(fd < 0){
+    fprintf(2, "bigwrite: cannot create bigwrite.tmp\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(n = 0; n < nblocks; n += m){
+    m = nblocks - n;
+    if(m > chunk)
+      m = chunk;
+    if(write(fd, buf, m*BSIZE) != m*BSIZE){
+      fprintf(2, "bigwrite: write failed at block %d\n", n);
+      exit(1);
+    }
+  }
+  close(fd);
+  t1 = uptime();
+  unlink("bigwrite.tmp");
+
+  printf("bigwrite: %d blocks in %d-block writes, %d ticks",
+         nblocks, chunk, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d blocks/sec)", nblocks * 10 / (t1 - t0));
+  printf("\n");
+
+  exit(0);
+}
@@ -0,0 +1,92 @@
+// File creation cost as the inode table fills up.
+// Creates nfiles empty files, NPERDIR to a directory so that
+// directory size does not dominate, and reports the ticks
+// taken by each thousand, then removes them all. The default
+// file system has few inodes; build one with more to create
+// the default 10000 files, e.g. make NINODES=12000.
+//
+//   createbench [nfiles]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+
+#define NFILES  10000
+#define NPERDIR 100
+#define BATCH   1000
+
+static char path[32];
+
+// Set path to cb<i/NPERDIR>, plus /f<i%NPERDIR> if file is set.
+static void
+name(int i, int file)
+{
+  char *p = path;
+  int d = i / NPERDIR, f = i % NPERDIR;
+
+  *p++ = 'c';
+  *p++ = 'b';
+  *p++ = '0' + d / 100 % 10;
+  *p++ = '0' + d / 10 % 10;
+  *p++ = '0' + d % 10;
+  if(file){
+    *p++ = '/';
+    *p++ = 'f';
+    *p++ = '0' + f / 10;
+    *p++ = '0' + f % 10;
+  }
+  *p = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, nfiles, t0, t1, start;
+
+  nfiles = NFILES;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1 || nfiles > 1000 * NPERDIR){
+    fprintf(2, "usage: createbench [nfiles(1-%d)]\n", 1000 * NPERDIR);
+    exit(1);
+  }
+
+  start = t0 = uptime();
+  for(i = 0; i < nfiles; i++){
+    if(i % NPERDIR == 0){
+      name(i, 0);
+      if(mkdir(path) < 0){
+        fprintf(2, "createbench: cannot create %s\n", path);
+        break;
+      }
+    }
+    name(i, 1);
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+      fprintf(2, "createbench: cannot create %s\n", path);
+      break;
+    }
+    close(fd);
+    if((i + 1) % BATCH == 0){
+      t1 = uptime();
+      printf("createbench: files %d-%d in %d ticks\n", i + 1 - BATCH, i, t1 - t0);
+      t0 = t1;
+    }
+  }
+  n = i;
+  t1 = uptime();
+  printf("createbench: %d files in %d ticks", n, t1 - start);
+  if(t1 > start)
+    printf(" (%d/sec)", n * 10 / (t1 - start));
+  printf("\n");
+
+  for(i = n - 1; i >= 0; i--){
+    name(i, 1);
+    unlink(path);
+    if(i % NPERDIR == 0){
+      name(i, 0);
+      unlink(path);
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,129 @@
+// Directory operation timings for one large directory.
+// Creates nfiles empty files in a fresh directory, opens
+// each of them by name, lists the directory the way ls does
+// (read every entry, then stat it), and removes them again,
+// reporting the ticks each phase took.
+//
+//   dirbench [nfiles]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define NFILES 500
+#define DIR    "dirbench.d"
+
+static char path[32];
+
+// Set path to DIR/f<i>.
+static void
+name(int i)
+{
+  char *p;
+  int n;
+
+  strcpy(path, DIR "/f");
+  p = path + strlen(path);
+  n = i;
+  do {
+    p++;
+    n /= 10;
+  } while(n > 0);
+  *p = 0;
+  do {
+    *--p = '0' + i % 10;
+    i /= 10;
+  } while(i > 0);
+}
+
+static void
+report(char *phase, int n, int ticks)
+{
+  printf("dirbench: %s %d in %d ticks", phase, n, ticks);
+  if(ticks > 0)
+    printf(" (%d/sec)", n * 10 / ticks);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, nfiles, t0;
+  struct dirent de;
+  struct stat st;
+
+  nfiles = NFILES;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1){
+    fprintf(2, "usage: dirbench [nfiles]\n");
+    exit(1);
+  }
+
+  if(mkdir(DIR) < 0){
+    fprintf(2, "dirbench: cannot create %s\n", DIR);
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nfiles; i++){
+    name(i);
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+      fprintf(2, "dirbench: cannot create %s\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  report("create", nfiles, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < nfiles; i++){
+    name(i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      fprintf(2, "dirbench: cannot open %s\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  report("lookup", nfiles, uptime() - t0);
+
+  t0 = uptime();
+  if((fd = open(DIR, O_RDONLY)) < 0){
+    fprintf(2, "dirbench: cannot open %s\n", DIR);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || de.name[0] == '.')
+      continue;
+    strcpy(path, DIR "/");
+    memmove(path + strlen(path), de.name, DIRSIZ);
+    path[strlen(DIR) + 1 + DIRSIZ] = 0;
+    if(stat(path, &st) < 0){
+      fprintf(2, "dirbench: cannot stat %s\n", path);
+      exit(1);
+    }
+    n++;
+  }
+  close(fd);
+  report("ls", n, uptime() - t0);
+  if(n != nfiles){
+    fprintf(2, "dirbench: listed %d files, expected %d\n", n, nfiles);
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nfiles; i++){
+    name(i);
+    if(unlink(path) < 0){
+      fprintf(2, "dirbench: cannot unlink %s\n", path);
+      exit(1);
+    }
+  }
+  report("unlink", nfiles, uptime() - t0);
+
+  unlink(DIR);
+  exit(0);
+}
@@ -0,0 +1,48 @@
+// Print the kernel log, removing what it prints from it.
+// Times are seconds since boot, from the 10MHz timer.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/klog.h"
+#include "user/user.h"
+
+#define NREC 16
+#define HZ   10000000  // r_time() ticks per second under qemu
+
+struct klogrec recs[NREC];
+
+// Print time t as seconds, to the microsecond.
+static void
+printtime(uint64 t)
+{
+  char frac[7];
+  int i, us;
+
+  us = t % HZ / (HZ / 1000000);
+  for(i = 5; i >= 0; i--, us /= 10)
+    frac[i] = '0' + us % 10;
+  frac[6] = 0;
+  printf("[%d.%s]", (int)(t / HZ), frac);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  if(argc > 1){
+    fprintf(2, "usage: dmesg\n");
+    exit(1);
+  }
+  while((n = klog_read(recs, NREC)) > 0){
+    for(i = 0; i < n; i++){
+      printtime(recs[i].time);
+      printf(" cpu%d: %s\n", recs[i].cpu, recs[i].msg);
+    }
+  }
+  if(n < 0){
+    fprintf(2, "dmesg: klog_read failed\n");
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,76 @@
+// Open/close storm.
+// nprocs processes at once each open and close a file, and
+// dup and close a descriptor, niters times, which exercises
+// file structure allocation and reference counting from all
+// CPUs together. Reports operations per second.
+//
+//   filebench [nprocs [niters]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NPROCS 4
+#define NITERS 2000
+
+char *path = "filebench.f";
+
+int
+main(int argc, char *argv[])
+{
+  int fd, fd1, i, j, nprocs, niters, n, t0, t1, xstatus, ok;
+
+  nprocs = NPROCS;
+  niters = NITERS;
+  if(argc > 1)
+    nprocs = atoi(argv[1]);
+  if(argc > 2)
+    niters = atoi(argv[2]);
+  if(nprocs < 1 || nprocs > 32 || niters < 1){
+    fprintf(2, "usage: filebench [nprocs(1-32) [niters]]\n");
+    exit(1);
+  }
+
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+    fprintf(2, "filebench: cannot create %s\n", path);
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < nprocs; i++){
+    if(fork() == 0){
+      if((fd = open(path, O_RDONLY)) < 0)
+        exit(1);
+      for(j = 0; j < niters; j++){
+        if((fd1 = open(path, O_RDONLY)) < 0)
+          exit(1);
+        close(fd1);
+        if((fd1 = dup(fd)) < 0)
+          exit(1);
+        close(fd1);
+      }
+      exit(0);
+    }
+  }
+  ok = 1;
+  for(i = 0; i < nprocs; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  t1 = uptime();
+  unlink(path);
+  if(!ok){
+    fprintf(2, "filebench: open or dup failed\n");
+    exit(1);
+  }
+
+  n = nprocs * niters * 2;
+  printf("filebench: %d procs, %d opens and dups in %d ticks", nprocs, n, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d/sec)", n * 10 / (t1 - t0));
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,82 @@
+// Block allocation cost as the disk fills up.
+// Writes files of FILEBLOCKS blocks each until the disk is
+// full (or nfiles files are written), reporting blocks per
+// second for each file, so a slowdown as free blocks get
+// scarce shows up directly. Removes the files at the end.
+//
+//   fillfs [nfiles]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define CHUNK      32
+#define FILEBLOCKS 2048
+#define MAXFILES   100
+
+char buf[CHUNK*BSIZE];
+char path[] = "fillfs00";
+
+static void
+setpath(int i)
+{
+  path[6] = '0' + i / 10;
+  path[7] = '0' + i % 10;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, m, nfiles, full, total, t0, t1, start;
+
+  nfiles = MAXFILES;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1 || nfiles > MAXFILES){
+    fprintf(2, "usage: fillfs [nfiles(1-%d)]\n", MAXFILES);
+    exit(1);
+  }
+
+  memset(buf, 'f', sizeof(buf));
+  full = 0;
+  total = 0;
+  start = uptime();
+  for(i = 0; i < nfiles && !full; i++){
+    setpath(i);
+    fd = open(path, O_CREATE | O_RDWR);
+    if(fd < 0){
+      fprintf(2, "fillfs: cannot create %s\n", path);
+      break;
+    }
+    t0 = uptime();
+    for(n = 0; n < FILEBLOCKS; n += m / BSIZE){
+      m = write(fd, buf, sizeof(buf));
+      if(m != sizeof(buf)){
+        if(m > 0)
+          n += m / BSIZE;
+        full = 1;
+        break;
+      }
+    }
+    t1 = uptime();
+    close(fd);
+    total += n;
+    printf("fillfs: %s: %d blocks in %d ticks", path, n, t1 - t0);
+    if(t1 > t0)
+      printf(" (%d blocks/sec)", n * 10 / (t1 - t0));
+    printf("\n");
+  }
+  t1 = uptime();
+  printf("fillfs: %d blocks in %d files in %d ticks", total, i, t1 - start);
+  if(t1 > start)
+    printf(" (%d blocks/sec)", total * 10 / (t1 - start));
+  printf("\n");
+
+  while(i-- > 0){
+    setpath(i);
+    unlink(path);
+  }
+  exit(0);
+}
@@ -0,0 +1,55 @@
+// Command launch latency.
+// Forks and execs a child that exits at once, niters times in
+// a row, as the shell does for each command, and reports
+// launches per second.
+//
+//   forkexec [niters]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NITERS 200
+
+int
+main(int argc, char *argv[])
+{
+  int i, pid, niters, t0, t1, xstatus;
+  char *args[] = { "forkexec", "-child", 0 };
+
+  if(argc > 1 && strcmp(argv[1], "-child") == 0)
+    exit(0);
+
+  niters = NITERS;
+  if(argc > 1)
+    niters = atoi(argv[1]);
+  if(niters < 1){
+    fprintf(2, "usage: forkexec [niters]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < niters; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkexec: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      fprintf(2, "forkexec: exec %s failed\n", args[0]);
+      exit(1);
+    }
+    if(wait(&xstatus) != pid || xstatus != 0){
+      fprintf(2, "forkexec: child failed\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+
+  printf("forkexec: %d launches in %d ticks", niters, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d/sec)", niters * 10 / (t1 - t0));
+  printf("\n");
+  exit(0);
+}
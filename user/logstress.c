@@ -0,0 +1,76 @@
+// File system write throughput with many concurrent writers.
+// Like stressfs, but with a configurable number of writers
+// and a report of how many blocks per second the log
+// sustained. Nothing is ever forced to disk explicitly;
+// every write() is its own small transaction, so the result
+// shows how well concurrent transactions are grouped into
+// commits.
+//
+//   logstress [nwriters [nblocks]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define NWRITERS 8
+#define NBLOCKS  32
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, nwriters, nblocks, t0, t1;
+  char path[] = "logstress0";
+  char data[BSIZE];
+
+  nwriters = NWRITERS;
+  nblocks = NBLOCKS;
+  if(argc > 1)
+    nwriters = atoi(argv[1]);
+  if(argc > 2)
+    nblocks = atoi(argv[2]);
+  if(nwriters < 1 || nwriters > 10 || nblocks < 1){
+    fprintf(2, "usage: logstress [nwriters(1-10) [nblocks]]\n");
+    exit(1);
+  }
+
+  printf("logstress: %d writers, %d blocks each\n", nwriters, nblocks);
+  memset(data, 'a', sizeof(data));
+
+  t0 = uptime();
+  for(i = 0; i < nwriters; i++){
+    if(fork() == 0){
+      path[9] += i;
+      fd = open(path, O_CREATE | O_RDWR);
+      if(fd < 0){
+        fprintf(2, "logstress: cannot create %s\n", path);
+        exit(1);
+      }
+      for(n = 0; n < nblocks; n++){
+        if(write(fd, data, sizeof(data)) != sizeof(data)){
+          fprintf(2, "logstress: write %s failed\n", path);
+          exit(1);
+        }
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  for(i = 0; i < nwriters; i++)
+    wait(0);
+  t1 = uptime();
+
+  for(i = 0; i < nwriters; i++){
+    path[9] = '0' + i;
+    unlink(path);
+  }
+
+  n = nwriters * nblocks;
+  printf("logstress: %d blocks in %d ticks", n, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d blocks/sec)", n * 10 / (t1 - t0));
+  printf("\n");
+
+  exit(0);
+}
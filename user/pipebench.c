@@ -0,0 +1,77 @@
+// Pipe bandwidth.
+// A child writes nkb kilobytes into a pipe in writes of
+// bufsize bytes, the parent reads them in reads of the same
+// size, and reports megabytes per second.
+//
+//   pipebench [nkb [bufsize]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NKB     16384
+#define BUFSIZE 4096
+#define MAXBUF  65536
+
+char buf[MAXBUF];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], pid, n, nkb, bufsize, total, left, t0, t1, xstatus;
+
+  nkb = NKB;
+  bufsize = BUFSIZE;
+  if(argc > 1)
+    nkb = atoi(argv[1]);
+  if(argc > 2)
+    bufsize = atoi(argv[2]);
+  if(nkb < 1 || nkb > 1024*1024 || bufsize < 1 || bufsize > MAXBUF){
+    fprintf(2, "usage: pipebench [nkb(1-%d) [bufsize(1-%d)]]\n", 1024*1024, MAXBUF);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "pipebench: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    memset(buf, 'p', bufsize);
+    for(left = nkb * 1024; left > 0; left -= n){
+      n = left < bufsize ? left : bufsize;
+      if(write(fds[1], buf, n) != n){
+        fprintf(2, "pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, bufsize)) > 0)
+    total += n;
+  close(fds[0]);
+  wait(&xstatus);
+  t1 = uptime();
+
+  if(total != nkb * 1024 || xstatus != 0){
+    fprintf(2, "pipebench: read %d bytes, expected %d\n", total, nkb * 1024);
+    exit(1);
+  }
+  printf("pipebench: %d KB in %d-byte pieces in %d ticks", nkb, bufsize, t1 - t0);
+  if(t1 > t0){
+    n = nkb * 100 / 1024 / (t1 - t0);  // tenths of MB/sec
+    printf(" (%d.%d MB/sec)", n / 10, n % 10);
+  }
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,136 @@
+// Many pipes read by one process.
+// nwriters children each write nmsgs messages into a pipe of
+// their own, and the parent reads them all with poll() and
+// non-blocking reads, checking each message, and reports
+// messages per second.
+//
+//   pollbench [nwriters [nmsgs]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "user/user.h"
+
+#define NWRITERS 8
+#define MAXWRITERS 32
+#define NMSGS    1000
+#define MSGSIZE  32
+
+struct pollfd pfd[MAXWRITERS];
+char buf[MAXWRITERS][MSGSIZE];
+int have[MAXWRITERS];
+int count[MAXWRITERS];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], i, j, n, nwriters, nmsgs, nopen, total, t0, t1, xstatus;
+  char msg[MSGSIZE];
+
+  nwriters = NWRITERS;
+  nmsgs = NMSGS;
+  if(argc > 1)
+    nwriters = atoi(argv[1]);
+  if(argc > 2)
+    nmsgs = atoi(argv[2]);
+  if(nwriters < 1 || nwriters > MAXWRITERS || nmsgs < 1){
+    fprintf(2, "usage: pollbench [nwriters(1-%d) [nmsgs]]\n", MAXWRITERS);
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nwriters; i++){
+    if(pipe(fds) < 0){
+      fprintf(2, "pollbench: pipe failed\n");
+      exit(1);
+    }
+    if(fork() == 0){
+      close(fds[0]);
+      memset(msg, 'a' + i, MSGSIZE);
+      for(j = 0; j < nmsgs; j++){
+        if(write(fds[1], msg, MSGSIZE) != MSGSIZE)
+          exit(1);
+      }
+      exit(0);
+    }
+    close(fds[1]);
+    if(fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+       (fcntl(fds[0], F_GETFL, 0) & O_NONBLOCK) == 0){
+      fprintf(2, "pollbench: fcntl failed\n");
+      exit(1);
+    }
+    pfd[i].fd = fds[0];
+    pfd[i].events = POLLIN;
+  }
+
+  total = 0;
+  for(nopen = nwriters; nopen > 0; ){
+    if(poll(pfd, nwriters, -1) <= 0){
+      fprintf(2, "pollbench: poll failed\n");
+      exit(1);
+    }
+    for(i = 0; i < nwriters; i++){
+      if(pfd[i].revents & POLLIN){
+        n = read(pfd[i].fd, buf[i] + have[i], MSGSIZE - have[i]);
+        if(n <= 0){
+          fprintf(2, "pollbench: read after POLLIN returned %d\n", n);
+          exit(1);
+        }
+        if((have[i] += n) == MSGSIZE){
+          for(j = 0; j < MSGSIZE; j++){
+            if(buf[i][j] != 'a' + i){
+              fprintf(2, "pollbench: pipe %d has wrong data\n", i);
+              exit(1);
+            }
+          }
+          have[i] = 0;
+          count[i]++;
+          total++;
+        }
+      } else if(pfd[i].revents & POLLHUP){
+        // writer gone and pipe drained.
+        if(read(pfd[i].fd, msg, 1) != 0){
+          fprintf(2, "pollbench: no end of file after POLLHUP\n");
+          exit(1);
+        }
+        close(pfd[i].fd);
+        pfd[i].fd = -1;
+        nopen--;
+      }
+    }
+  }
+  for(i = 0; i < nwriters; i++){
+    wait(&xstatus);
+    if(xstatus != 0 || count[i] != nmsgs){
+      fprintf(2, "pollbench: pipe %d delivered %d messages, expected %d\n", i, count[i], nmsgs);
+      exit(1);
+    }
+  }
+  t1 = uptime();
+
+  // an empty pipe with a writer: poll() must time out and a
+  // non-blocking read or splice must not wait.
+  if(pipe(fds) < 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+     (n = open("pollbench.tmp", O_CREATE | O_RDWR)) < 0){
+    fprintf(2, "pollbench: pipe failed\n");
+    exit(1);
+  }
+  pfd[0].fd = fds[0];
+  pfd[0].events = POLLIN;
+  if(poll(pfd, 1, 2) != 0 || pfd[0].revents != 0 || read(fds[0], msg, 1) != -1 ||
+     splice(fds[0], n, 1) != -1){
+    fprintf(2, "pollbench: empty pipe looks ready\n");
+    exit(1);
+  }
+  close(n);
+  unlink("pollbench.tmp");
+  close(fds[0]);
+  close(fds[1]);
+
+  printf("pollbench: %d pipes, %d messages in %d ticks", nwriters, total, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d/sec)", total * 10 / (t1 - t0));
+  printf("\n");
+  exit(0);
+}
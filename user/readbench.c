@@ -0,0 +1,102 @@
+// Concurrent reads of one file.
+// Writes a file of nblocks blocks, then has nreaders processes
+// each open it and read it through npasses times at once,
+// reporting blocks per second for all of them together, and
+// checking what they read. Removes the file at the end.
+//
+//   readbench [nreaders [nblocks [npasses]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define NREADERS 4
+#define NBLOCKS  256
+#define NPASSES  8
+#define CHUNK    8
+
+char buf[CHUNK*BSIZE];
+char *path = "readbench.f";
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, j, k, n, nreaders, nblocks, npasses, t0, t1, xstatus, ok;
+
+  nreaders = NREADERS;
+  nblocks = NBLOCKS;
+  npasses = NPASSES;
+  if(argc > 1)
+    nreaders = atoi(argv[1]);
+  if(argc > 2)
+    nblocks = atoi(argv[2]);
+  if(argc > 3)
+    npasses = atoi(argv[3]);
+  if(nreaders < 1 || nreaders > 32 || nblocks < 1 || npasses < 1){
+    fprintf(2, "usage: readbench [nreaders(1-32) [nblocks [npasses]]]\n");
+    exit(1);
+  }
+
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+    fprintf(2, "readbench: cannot create %s\n", path);
+    exit(1);
+  }
+  for(i = 0; i < nblocks; i++){
+    memset(buf, 'a' + i % 26, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      fprintf(2, "readbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < nreaders; i++){
+    if(fork() == 0){
+      if((fd = open(path, O_RDONLY)) < 0){
+        fprintf(2, "readbench: cannot open %s\n", path);
+        exit(1);
+      }
+      for(j = 0; j < npasses; j++){
+        k = 0;
+        while((n = read(fd, buf, sizeof(buf))) > 0){
+          for(i = 0; i < n; i += BSIZE, k++){
+            if(buf[i] != 'a' + k % 26 || buf[i+BSIZE-1] != 'a' + k % 26){
+              fprintf(2, "readbench: block %d has wrong content\n", k);
+              exit(1);
+            }
+          }
+        }
+        if(n < 0 || k != nblocks){
+          fprintf(2, "readbench: read %d blocks, expected %d\n", k, nblocks);
+          exit(1);
+        }
+        close(fd);
+        if((fd = open(path, O_RDONLY)) < 0){
+          fprintf(2, "readbench: cannot open %s\n", path);
+          exit(1);
+        }
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  ok = 1;
+  for(i = 0; i < nreaders; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  t1 = uptime();
+
+  n = nreaders * npasses * nblocks;
+  printf("readbench: %d readers read %d blocks in %d ticks", nreaders, n, t1 - t0);
+  if(t1 > t0)
+    printf(" (%d blocks/sec)", n * 10 / (t1 - t0));
+  printf("\n");
+
+  unlink(path);
+  exit(ok ? 0 : 1);
+}
@@ -0,0 +1,148 @@
+// Many small-file reads, with one system call per operation
+// and through the submission ring. Creates nfiles small files,
+// then opens, reads and closes each of them nrounds times,
+// first with open(), read() and close(), then by queueing the
+// same operations on the ring, a batch of files at a time, and
+// reports files per second for each. Removes the files.
+//
+//   ringbench [nfiles [nrounds]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/ring.h"
+#include "user/user.h"
+
+#define NFILES  64
+#define NROUNDS 20
+#define FSIZE   100
+#define BATCH   8    // files open at once; well under NOFILE
+
+struct ring *r;
+char path[] = "ringbench00";
+char names[BATCH][sizeof(path)];
+char buf[BATCH][FSIZE];
+int fds[BATCH];
+
+static void
+setpath(char *p, int i)
+{
+  strcpy(p, path);
+  p[9] = '0' + i / 10;
+  p[10] = '0' + i % 10;
+}
+
+static void
+submit(int op, int fd, void *addr, int n, int data)
+{
+  struct ringsqe *e = &r->sq[r->sqtail % RINGSIZE];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->data = data;
+  __sync_synchronize();
+  r->sqtail++;
+}
+
+// Run what is queued, and fail unless every call returned
+// at least min; returns the results in res[data].
+static void
+enter(int *res, int min)
+{
+  struct ringcqe *c;
+
+  if(ring_enter(0) < 0){
+    fprintf(2, "ringbench: ring_enter failed\n");
+    exit(1);
+  }
+  while(r->cqhead != r->cqtail){
+    c = &r->cq[r->cqhead % RINGSIZE];
+    if(c->res < min){
+      fprintf(2, "ringbench: ring operation failed\n");
+      exit(1);
+    }
+    if(res)
+      res[c->data] = c->res;
+    r->cqhead++;
+  }
+}
+
+static void
+report(char *how, int n, int ticks)
+{
+  printf("ringbench: %s: %d files in %d ticks", how, n, ticks);
+  if(ticks > 0)
+    printf(" (%d files/sec)", n * 10 / ticks);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, j, k, nfiles, nrounds, t0;
+
+  nfiles = NFILES;
+  nrounds = NROUNDS;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(argc > 2)
+    nrounds = atoi(argv[2]);
+  if(nfiles < 1 || nfiles > 100 || nrounds < 1){
+    fprintf(2, "usage: ringbench [nfiles(1-100) [nrounds]]\n");
+    exit(1);
+  }
+  if((r = ring_setup()) == (struct ring*)-1){
+    fprintf(2, "ringbench: ring_setup failed\n");
+    exit(1);
+  }
+
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < nfiles; i++){
+    setpath(names[0], i);
+    if((fd = open(names[0], O_CREATE | O_WRONLY)) < 0 || write(fd, buf[0], FSIZE) != FSIZE){
+      fprintf(2, "ringbench: cannot create %s\n", names[0]);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  t0 = uptime();
+  for(j = 0; j < nrounds; j++){
+    for(i = 0; i < nfiles; i++){
+      setpath(names[0], i);
+      if((fd = open(names[0], O_RDONLY)) < 0 || read(fd, buf[0], FSIZE) != FSIZE){
+        fprintf(2, "ringbench: cannot read %s\n", names[0]);
+        exit(1);
+      }
+      close(fd);
+    }
+  }
+  report("syscalls", nfiles * nrounds, uptime() - t0);
+
+  // a batch takes two traps: one to open its files, and one
+  // to read and close them, since reads need the descriptors.
+  t0 = uptime();
+  for(j = 0; j < nrounds; j++){
+    for(i = 0; i < nfiles; i += BATCH){
+      for(k = 0; k < BATCH && i + k < nfiles; k++){
+        setpath(names[k], i + k);
+        submit(RING_OPEN, 0, names[k], O_RDONLY, k);
+      }
+      enter(fds, 0);
+      for(k = 0; k < BATCH && i + k < nfiles; k++){
+        submit(RING_READ, fds[k], buf[k], FSIZE, k);
+        submit(RING_CLOSE, fds[k], 0, 0, k);
+      }
+      enter(0, 0);
+    }
+  }
+  report("ring", nfiles * nrounds, uptime() - t0);
+
+  for(i = 0; i < nfiles; i++){
+    setpath(names[0], i);
+    unlink(names[0]);
+  }
+  exit(0);
+}
@@ -0,0 +1,93 @@
+// Sequential read after write, with files written in small
+// pieces by several processes at once, which tends to
+// interleave their blocks on disk. Reports blocks per second
+// for writing all the files and for reading each back in
+// large reads, then removes them.
+//
+//   seqrw [nwriters [nblocks [writesize]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define NWRITERS 4
+#define NBLOCKS  512
+#define WSIZE    512
+#define CHUNK    32
+
+char buf[CHUNK*BSIZE];
+char path[] = "seqrw0";
+
+static void
+report(char *phase, int n, int ticks)
+{
+  printf("seqrw: %s %d blocks in %d ticks", phase, n, ticks);
+  if(ticks > 0)
+    printf(" (%d blocks/sec)", n * 10 / ticks);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, m, nwriters, nblocks, wsize, t0;
+
+  nwriters = NWRITERS;
+  nblocks = NBLOCKS;
+  wsize = WSIZE;
+  if(argc > 1)
+    nwriters = atoi(argv[1]);
+  if(argc > 2)
+    nblocks = atoi(argv[2]);
+  if(argc > 3)
+    wsize = atoi(argv[3]);
+  if(nwriters < 1 || nwriters > 10 || nblocks < 1 || wsize < 1 || wsize > CHUNK*BSIZE){
+    fprintf(2, "usage: seqrw [nwriters(1-10) [nblocks [writesize(1-%d)]]]\n", CHUNK*BSIZE);
+    exit(1);
+  }
+
+  memset(buf, 's', sizeof(buf));
+  t0 = uptime();
+  for(i = 0; i < nwriters; i++){
+    if(fork() == 0){
+      path[5] += i;
+      if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+        fprintf(2, "seqrw: cannot create %s\n", path);
+        exit(1);
+      }
+      for(n = 0; n < nblocks * BSIZE; n += wsize){
+        if(write(fd, buf, wsize) != wsize){
+          fprintf(2, "seqrw: write %s failed\n", path);
+          exit(1);
+        }
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  for(i = 0; i < nwriters; i++)
+    wait(0);
+  report("write", nwriters * nblocks, uptime() - t0);
+
+  t0 = uptime();
+  n = 0;
+  for(i = 0; i < nwriters; i++){
+    path[5] = '0' + i;
+    if((fd = open(path, O_RDONLY)) < 0){
+      fprintf(2, "seqrw: cannot open %s\n", path);
+      exit(1);
+    }
+    while((m = read(fd, buf, sizeof(buf))) > 0)
+      n += m;
+    close(fd);
+  }
+  report("read", n / BSIZE, uptime() - t0);
+
+  for(i = 0; i < nwriters; i++){
+    path[5] = '0' + i;
+    unlink(path);
+  }
+  exit(0);
+}
@@ -1,4 +1,8 @@
 struct stat;
+struct iovec;
+struct ring;
+struct klogrec;
+struct pollfd;
 typedef unsigned int uint;
 
 
@@ -27,6 +31,16 @@ int uptime(void);
 int getppid(void); 
 int clone(void (*fcn)(void*, void*), void*, void*, void*);
 int join(void **);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+struct ring* ring_setup(void);
+int ring_enter(int);
+int klog_read(struct klogrec*, int);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
 
 
 //MLFQ system calls
@@ -581,7 +581,11 @@ writetest(char *s)
 void
 writebig(char *s)
 {
-  int i, fd, n;
+  int i, fd, n, nblocks;
+
+  // enough to use a few of the doubly-indirect block's
+  // indirect blocks, without filling the disk.
+  nblocks = NDIRECT + NINDIRECT + 3*NINDIRECT;
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -589,7 +593,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < nblocks; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +613,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != nblocks){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
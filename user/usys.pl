@@ -43,4 +43,14 @@ entry("mlfqmode");
 entry("fcfsmode");
 entry("yield");
 entry("clone");
-entry("join");
\ No newline at end of file
+entry("join");
+entry("splice");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("ring_setup");
+entry("ring_enter");
+entry("klog_read");
+entry("poll");
+entry("fcntl");
\ No newline at end of file